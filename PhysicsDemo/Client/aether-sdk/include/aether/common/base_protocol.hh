@@ -1,7 +1,9 @@
 #pragma once
 
 #include <chrono>
+#include <cstddef>
 #include <cstdint>
+#include <optional>
 #include "vector.hh"
 #include "morton/encoding.hh"
 #include "morton/cell.hh"
@@ -13,6 +15,7 @@ namespace base {
 
 using net_position_2d = vec2f;
 using net_position_3d = vec3f;
+using net_velocity_3d = vec3f;
 
 enum entity_flags : uint32_t {
     is_owned   = (1 << 0),
@@ -46,6 +49,10 @@ static uint64_t get_entity_id(const net_point_2d &entity) {
     return entity.id;
 }
 
+static constexpr size_t get_entity_id_offset(const net_point_2d &) {
+    return offsetof(net_point_2d, id);
+}
+
 static std::optional<uint64_t> get_owner_id(const net_point_2d &entity) {
     if ((entity.flags & entity_flags::is_owned) != 0) {
       return { entity.owner_id };
@@ -93,6 +100,10 @@ static uint64_t get_entity_id(const net_point_3d &entity) {
     return entity.id;
 }
 
+static constexpr size_t get_entity_id_offset(const net_point_3d &) {
+    return offsetof(net_point_3d, id);
+}
+
 static std::optional<uint64_t> get_owner_id(const net_point_3d &entity) {
     if ((entity.flags & entity_flags::is_owned) != 0) {
       return { entity.owner_id };
@@ -122,6 +133,106 @@ static bool is_entity_dropped(const struct net_point_3d &entity) {
     return (entity.flags & entity_flags::is_dropped) != 0;
 }
 
+// A net_point_3d that also carries its linear velocity, so that clients can
+// extrapolate its position between updates
+HADEAN_PACK(struct net_moving_point_3d {
+    net_position_3d net_encoded_position;
+    net_quat net_encoded_orientation;
+    net_velocity_3d net_encoded_velocity;
+    uint32_t net_encoded_color;
+    uint64_t id;
+    uint32_t owner_id;
+    float size;
+    uint32_t flags = 0;
+});
+
+static uint64_t get_entity_id(const net_moving_point_3d &entity) {
+    return entity.id;
+}
+
+static constexpr size_t get_entity_id_offset(const net_moving_point_3d &) {
+    return offsetof(net_moving_point_3d, id);
+}
+
+static std::optional<uint64_t> get_owner_id(const net_moving_point_3d &entity) {
+    if ((entity.flags & entity_flags::is_owned) != 0) {
+      return { entity.owner_id };
+    } else {
+      return std::nullopt;
+    }
+}
+
+static vec3f get_position(const net_moving_point_3d &entity) {
+    return entity.net_encoded_position;
+}
+
+static void synthesize_dead_entity(const uint64_t id, struct net_moving_point_3d &entity) {
+    entity.id = id;
+    entity.flags |= entity_flags::is_dead;
+}
+
+static bool is_entity_dead(const struct net_moving_point_3d &entity) {
+    return (entity.flags & entity_flags::is_dead) != 0;
+}
+
+static void synthesize_drop_entity(struct net_moving_point_3d &entity) {
+    entity.flags |= entity_flags::is_dropped;
+}
+
+static bool is_entity_dropped(const struct net_moving_point_3d &entity) {
+    return (entity.flags & entity_flags::is_dropped) != 0;
+}
+
+static vec3f get_velocity(const net_point_3d &) {
+    return vec3f::zero();
+}
+
+static vec3f get_velocity(const net_moving_point_3d &entity) {
+    return entity.net_encoded_velocity;
+}
+
+// The angle in radians of the rotation between two orientations
+static float get_rotation_angle(const net_quat &a, const net_quat &b) {
+    const float cos_half_angle = std::abs(a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w);
+    return 2.0f * std::acos(cos_half_angle < 1.0f ? cos_half_angle : 1.0f);
+}
+
+// Prediction errors measure how far an entity is from where a client would draw it,
+// having extrapolated the last state it was sent for elapsed seconds at that state's
+// velocity. Rotations count as the distance they move a point size away from the
+// centre. std::nullopt means the entity has changed in a way that extrapolation
+// cannot follow, such as its colour or flags.
+static std::optional<float> get_prediction_error(const net_point_2d &sent, const net_point_2d &current, const float) {
+    if (sent.net_encoded_color != current.net_encoded_color || sent.id != current.id
+        || sent.owner_id != current.owner_id || sent.flags != current.flags) {
+        return std::nullopt;
+    }
+    const vec2f offset = get_position(current) - get_position(sent);
+    return std::sqrt(offset.x * offset.x + offset.y * offset.y);
+}
+
+template<typename Point>
+static std::optional<float> get_prediction_error_3d(const Point &sent, const Point &current, const float elapsed) {
+    if (sent.net_encoded_color != current.net_encoded_color || sent.id != current.id
+        || sent.owner_id != current.owner_id || sent.size != current.size || sent.flags != current.flags) {
+        return std::nullopt;
+    }
+    const vec3f offset = get_position(current) - (get_position(sent) + get_velocity(sent) * elapsed);
+    const float position_error = std::sqrt(offset.dot(offset));
+    const net_quat sent_orientation = sent.net_encoded_orientation;
+    const net_quat current_orientation = current.net_encoded_orientation;
+    const float rotation_error = get_rotation_angle(sent_orientation, current_orientation) * current.size;
+    return position_error > rotation_error ? position_error : rotation_error;
+}
+
+static std::optional<float> get_prediction_error(const net_point_3d &sent, const net_point_3d &current, const float elapsed) {
+    return get_prediction_error_3d(sent, current, elapsed);
+}
+
+static std::optional<float> get_prediction_error(const net_moving_point_3d &sent, const net_moving_point_3d &current, const float elapsed) {
+    return get_prediction_error_3d(sent, current, elapsed);
+}
+
 HADEAN_PACK(struct client_stats {
     uint64_t num_agents;
     uint64_t num_agents_ghost;
@@ -131,6 +242,9 @@ HADEAN_PACK(struct client_message {
     net_tree_cell cell;
     bool cell_dying;
     client_stats stats;
+    // Ticks the worker has simulated, so clients can tell when the state was taken
+    // independently of network delays. Zero if the worker does not count ticks.
+    uint64_t tick = 0;
 });
 
 static net_position_2d net_encode_position_2f(const vec2f &v, const net_tree_cell &cell) {
@@ -190,6 +304,7 @@ typedef HADEAN_PACK(struct aether_event_t {
 
 static_assert(std::is_trivially_copyable<net_point_2d>::value, "net structs must be trivially copyable");
 static_assert(std::is_trivially_copyable<net_point_3d>::value, "net structs must be trivially copyable");
+static_assert(std::is_trivially_copyable<net_moving_point_3d>::value, "net structs must be trivially copyable");
 static_assert(std::is_trivially_copyable<client_message>::value, "net structs must be trivially copyable");
 
 }
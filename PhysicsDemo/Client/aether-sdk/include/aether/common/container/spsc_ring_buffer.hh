@@ -0,0 +1,200 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+#include <memory>
+#include <cstdlib>
+#include <cstdio>
+#include <aether/common/hadean_platform.hh>
+#include <aether/common/span.hh>
+
+namespace aether {
+
+namespace container {
+
+// A fixed capacity ring buffer shared by exactly one producer thread and one consumer
+// thread without locks. The capacity must be a power of two. The producer only calls the producer functions and the
+// consumer only calls the consumer functions; both may call capacity().
+//
+// head and tail are free-running counters published with release stores and read
+// with acquire loads, so each side sees the bytes the other side has finished with.
+// move_tail() and move_head() report when they took the buffer out of the empty or
+// full state. A side that blocks waiting for that transition should be woken by the
+// other side only when this is reported, which keeps wake-up system calls off the
+// common path.
+template<typename T>
+class spsc_ring_buffer {
+private:
+    static_assert(std::is_trivial<T>::value, "Only trivial types are supported");
+    using value_type = T;
+    static constexpr size_t CACHE_LINE_SIZE = 64;
+
+    struct free_deleter {
+        void operator()(void *x) { ::free(x); }
+    };
+
+    using holder_type = std::unique_ptr<value_type[], free_deleter>;
+    const size_t cap;
+    const size_t mask;
+    holder_type data;
+
+    // Written by the consumer
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> head{0};
+    // The consumer's last view of tail, used to check moves
+    size_t cached_tail = 0;
+
+    // Written by the producer
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> tail{0};
+    // The producer's last view of head, used to check moves
+    size_t cached_head = 0;
+
+    static holder_type allocate(const size_t capacity) {
+        auto *const ptr = static_cast<value_type*>(malloc(std::max<size_t>(capacity, 1) * sizeof(value_type)));
+        if (ptr == nullptr) {
+            perror("spsc_ring_buffer<T>::allocate():");
+            abort();
+        }
+        return holder_type(ptr);
+    }
+
+public:
+    explicit spsc_ring_buffer(const size_t capacity) : cap(capacity), mask(capacity - 1), data(allocate(capacity)) {
+        assert(cap > 0 && (cap & mask) == 0 && "Capacity must be a power of two");
+    }
+
+    spsc_ring_buffer(const spsc_ring_buffer&) = delete;
+    spsc_ring_buffer &operator=(const spsc_ring_buffer&) = delete;
+
+    size_t capacity() const {
+        return cap;
+    }
+
+    // Producer functions
+
+    size_t free() {
+        const size_t current_tail = tail.load(std::memory_order_relaxed);
+        cached_head = head.load(std::memory_order_acquire);
+        return cap - (current_tail - cached_head);
+    }
+
+    bool has_space() {
+        return free() != 0;
+    }
+
+    span<value_type> get_unallocated() {
+        const size_t unused = free();
+        const size_t ustart = tail.load(std::memory_order_relaxed) & mask;
+        return span<value_type>(&data[ustart], std::min(unused, cap - ustart));
+    }
+
+    // The free space as up to two regions, in the order they should be filled. The
+    // second region is empty unless the free space wraps around the end.
+    std::array<span<value_type>, 2> get_unallocated_regions() {
+        const auto first = get_unallocated();
+        const size_t remaining = free() - first.size();
+        return {{ first, span<value_type>(&data[0], remaining) }};
+    }
+
+    // Publishes count elements written to get_unallocated() or
+    // get_unallocated_regions(). Returns true if the buffer was empty from the
+    // consumer's point of view.
+    bool move_tail(const size_t count) {
+        const size_t old_tail = tail.load(std::memory_order_relaxed);
+        assert(count <= cap - (old_tail - cached_head));
+        tail.store(old_tail + count, std::memory_order_release);
+        // Orders the store above before the load below. Paired with the fence in
+        // move_head(), either this side sees the consumer's progress or the consumer
+        // sees this store, so a transition can not be missed by both.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        cached_head = head.load(std::memory_order_relaxed);
+        return count != 0 && cached_head == old_tail;
+    }
+
+    size_t try_write(const value_type *new_data, const size_t data_length) {
+        size_t copied = 0;
+        while (copied < data_length) {
+            const auto unallocated = get_unallocated();
+            if (unallocated.empty()) { break; }
+            const auto copy_size = std::min(data_length - copied, unallocated.size());
+            memcpy(unallocated.data(), new_data + copied, copy_size * sizeof(value_type));
+            move_tail(copy_size);
+            copied += copy_size;
+        }
+        return copied;
+    }
+
+    // Consumer functions
+
+    size_t size() {
+        const size_t current_head = head.load(std::memory_order_relaxed);
+        cached_tail = tail.load(std::memory_order_acquire);
+        return cached_tail - current_head;
+    }
+
+    bool is_empty() {
+        return size() == 0;
+    }
+
+    span<const value_type> get_head() {
+        const size_t used = size();
+        const size_t start = head.load(std::memory_order_relaxed) & mask;
+        return span<const value_type>(&data[start], std::min(used, cap - start));
+    }
+
+    // The contiguous run of unread elements starting offset elements after the head.
+    // The consumer owns these elements until it moves the head past them.
+    span<value_type> get_from_offset(const size_t offset) {
+        const size_t used = size();
+        assert(offset <= used);
+        const size_t start = (head.load(std::memory_order_relaxed) + offset) & mask;
+        return span<value_type>(&data[start], std::min(used - offset, cap - start));
+    }
+
+    // Copies count unread elements starting offset elements after the head without
+    // consuming them. Returns false if fewer are available.
+    bool peek(value_type *out, const size_t offset, const size_t count) {
+        if (size() < offset + count) { return false; }
+        size_t copied = 0;
+        while (copied < count) {
+            const auto run = get_from_offset(offset + copied);
+            const auto copy_size = std::min(count - copied, run.size());
+            memcpy(out + copied, run.data(), copy_size * sizeof(value_type));
+            copied += copy_size;
+        }
+        return true;
+    }
+
+    // Releases count elements read from get_head(), get_from_offset() or peek().
+    // Returns true if the buffer was full from the producer's point of view.
+    bool move_head(const size_t count) {
+        const size_t old_head = head.load(std::memory_order_relaxed);
+        assert(count <= cached_tail - old_head);
+        head.store(old_head + count, std::memory_order_release);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        cached_tail = tail.load(std::memory_order_relaxed);
+        return count != 0 && cached_tail - old_head == cap;
+    }
+
+    // Copies out up to out_length elements. was_full is set if the read took the
+    // buffer out of the full state.
+    size_t try_read(value_type *out, const size_t out_length, bool &was_full) {
+        size_t copied = 0;
+        while (copied < out_length) {
+            const auto head_span = get_head();
+            if (head_span.empty()) { break; }
+            const auto copy_size = std::min(out_length - copied, head_span.size());
+            memcpy(out + copied, head_span.data(), copy_size * sizeof(value_type));
+            was_full |= move_head(copy_size);
+            copied += copy_size;
+        }
+        return copied;
+    }
+};
+
+}
+
+}
@@ -8,21 +8,29 @@ namespace aether {
 
 namespace hash {
 
+namespace detail {
+
+// FNV-1a parameters by hash width. These are specialised at namespace scope, as
+// explicit specialisations inside a class are not standard C++.
+template<typename T> struct fnv_constants { };
+
+template<>
+struct fnv_constants<uint64_t> {
+    static constexpr size_t basis = 0xcbf29ce484222325ul;
+    static constexpr size_t prime = 0x100000001b3ul;
+};
+
+template<>
+struct fnv_constants<uint32_t> {
+    static constexpr size_t basis = 0x811c9dc5ul;
+    static constexpr size_t prime = 0x1000193ul;
+};
+
+}
+
 // A hasher based on FNV-1a
 struct hasher {
-    template<typename T> struct constants { };
-
-    template<>
-    struct constants<uint64_t> {
-        static constexpr size_t basis = 0xcbf29ce484222325ul;
-        static constexpr size_t prime = 0x100000001b3ul;
-    };
-
-    template<>
-    struct constants<uint32_t> {
-        static constexpr size_t basis = 0x811c9dc5ul;
-        static constexpr size_t prime = 0x1000193ul;
-    };
+    template<typename T> using constants = detail::fnv_constants<T>;
 
     static constexpr size_t get_basis() {
         return constants<size_t>::basis;
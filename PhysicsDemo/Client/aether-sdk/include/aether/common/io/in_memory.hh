@@ -27,6 +27,10 @@ struct in_memory_reader final : public aether::reader {
     in_memory_reader(const void *buf, const size_t len)
         : storage(static_cast<const char*>(buf)), offset(0), size(len) {
     }
+
+    size_t remaining() const {
+        return size - offset;
+    }
 };
 
 template<typename Storage>
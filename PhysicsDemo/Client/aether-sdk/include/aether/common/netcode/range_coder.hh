@@ -0,0 +1,450 @@
+#pragma once
+
+#include <array>
+#include <climits>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+#include <aether/common/netcode/transcode.hh>
+
+namespace aether {
+namespace netcode {
+namespace transcode {
+
+/// Probability models shared by the range encoder and decoder
+namespace range_model {
+
+/// Number of bits of precision in a probability
+static constexpr uint32_t probability_bits = 11;
+/// Adaptation speed. Smaller adapts faster but is noisier.
+static constexpr uint32_t adaptation_shift = 5;
+static constexpr uint32_t top_value = static_cast<uint32_t>(1) << 24;
+
+/// Adaptive probability that the next bit is 0
+struct adaptive_bit {
+    uint16_t probability = (1 << probability_bits) / 2;
+
+    void update(const uint32_t bit) {
+        if (bit == 0) {
+            probability += ((1 << probability_bits) - probability) >> adaptation_shift;
+        } else {
+            probability -= probability >> adaptation_shift;
+        }
+    }
+};
+
+}
+
+/// Binary range coder in the style of LZMA. Symbols are coded either against an
+/// adaptive probability (`encode_bit`) or as equiprobable direct bits (`encode_direct`).
+///
+/// Arithmetic coded output can not be interleaved with the raw bits of a
+/// `bit_appender`, so range coders have their own appender/stream pair. A message is
+/// coded into a `range_appender`, which is flushed by `finish()` or on destruction.
+struct range_appender {
+  private:
+    std::vector<uint8_t> &output;
+    uint64_t low = 0;
+    uint32_t range = 0xFFFFFFFF;
+    uint8_t cache = 0;
+    uint64_t cache_size = 1;
+    bool finished = false;
+
+    void shift_low() {
+        if (static_cast<uint32_t>(low) < 0xFF000000 || (low >> 32) != 0) {
+            const auto carry = static_cast<uint8_t>(low >> 32);
+            uint8_t temp = cache;
+            do {
+                output.push_back(static_cast<uint8_t>(temp + carry));
+                temp = 0xFF;
+            } while (--cache_size != 0);
+            cache = static_cast<uint8_t>(low >> 24);
+        }
+        ++cache_size;
+        low = (low & 0x00FFFFFF) << 8;
+    }
+
+    void normalize() {
+        while (range < range_model::top_value) {
+            range <<= 8;
+            shift_low();
+        }
+    }
+
+  public:
+    explicit range_appender(std::vector<uint8_t> &_output) : output(_output) {
+    }
+
+    ~range_appender() {
+        finish();
+    }
+
+    /// Code `bit` against the adaptive probability `p`, then update `p`
+    void encode_bit(range_model::adaptive_bit &p, const uint32_t bit) {
+        const uint32_t bound = (range >> range_model::probability_bits) * p.probability;
+        if (bit == 0) {
+            range = bound;
+        } else {
+            low += bound;
+            range -= bound;
+        }
+        p.update(bit);
+        normalize();
+    }
+
+    /// Code the low `nbits` bits of `value`, most significant first, with probability 1/2
+    void encode_direct(const uint64_t value, const size_t nbits) {
+        for (size_t i = nbits; i-- > 0;) {
+            range >>= 1;
+            if ((value >> i) & 1) {
+                low += range;
+            }
+            normalize();
+        }
+    }
+
+    /// Flush the coder state after the last symbol. Later calls do nothing.
+    void finish() {
+        if (finished) {
+            return;
+        }
+        for (int i = 0; i < 5; ++i) {
+            shift_low();
+        }
+        finished = true;
+    }
+};
+
+/// Range decoder that reads from a byte array produced by `range_appender`
+struct range_stream {
+  private:
+    const std::vector<uint8_t> &input;
+    size_t offset;
+    uint32_t range = 0xFFFFFFFF;
+    uint32_t code = 0;
+    bool overrun = false;
+
+    uint8_t next_byte() {
+        if (offset >= input.size()) {
+            overrun = true;
+            return 0;
+        }
+        return input[offset++];
+    }
+
+    void normalize() {
+        if (range < range_model::top_value) {
+            range <<= 8;
+            code = (code << 8) | next_byte();
+        }
+    }
+
+  public:
+    /// Construct a range stream over the coded bytes of `v` that start at `offset_`
+    range_stream(const std::vector<uint8_t> &v, size_t offset_ = 0)
+        : input(v), offset(offset_) {
+        for (int i = 0; i < 5; ++i) {
+            code = (code << 8) | next_byte();
+        }
+    }
+
+    /// Decode a bit against the adaptive probability `p`, then update `p`
+    uint32_t decode_bit(range_model::adaptive_bit &p) {
+        const uint32_t bound = (range >> range_model::probability_bits) * p.probability;
+        uint32_t bit;
+        if (code < bound) {
+            range = bound;
+            bit = 0;
+        } else {
+            code -= bound;
+            range -= bound;
+            bit = 1;
+        }
+        p.update(bit);
+        normalize();
+        return bit;
+    }
+
+    /// Decode `nbits` equiprobable bits, most significant first
+    uint64_t decode_direct(const size_t nbits) {
+        uint64_t result = 0;
+        for (size_t i = 0; i < nbits; ++i) {
+            range >>= 1;
+            uint32_t bit = 0;
+            if (code >= range) {
+                code -= range;
+                bit = 1;
+            }
+            result = (result << 1) | bit;
+            normalize();
+        }
+        return result;
+    }
+
+    /// Whether the decoder has read past the end of the input
+    bool ok() const {
+        return !overrun;
+    }
+};
+
+namespace range_model {
+
+/// Adaptive model for symbols of `NumBits` bits, coded as a binary tree of probabilities
+template <size_t NumBits>
+struct bit_tree {
+    std::array<adaptive_bit, static_cast<size_t>(1) << NumBits> probabilities{};
+
+    void encode(range_appender &w, const uint32_t symbol) {
+        uint32_t node = 1;
+        for (size_t i = NumBits; i-- > 0;) {
+            const uint32_t bit = (symbol >> i) & 1;
+            w.encode_bit(probabilities[node], bit);
+            node = (node << 1) | bit;
+        }
+    }
+
+    uint32_t decode(range_stream &r) {
+        uint32_t node = 1;
+        for (size_t i = 0; i < NumBits; ++i) {
+            node = (node << 1) | r.decode_bit(probabilities[node]);
+        }
+        return node - (static_cast<uint32_t>(1) << NumBits);
+    }
+};
+
+}
+
+/// Base interface for transcoders that code into a range coder
+template <typename T>
+struct range_transcode_base {
+  public:
+    using Item = T;
+    virtual bool encode(const T &input, range_appender &w) = 0;
+    virtual bool decode(range_stream &r, T &out) = 0;
+    virtual ~range_transcode_base() {
+    }
+};
+
+/// A coder that transforms the input with `Transformer`, then range codes it with `Coder`
+template <typename T, typename Transformer, typename Coder>
+struct range_transform_coder final : public range_transcode_base<T> {
+  private:
+    static_assert(
+        std::is_base_of<range_transcode_base<typename Coder::Item>, Coder>::value,
+        "Coder is not a range transcoder");
+    static_assert(
+        std::is_base_of<transform_base<T, typename Coder::Item>, Transformer>::value,
+        "Transformer argument is not a valid Transformer");
+    Transformer t{};
+    Coder c{};
+
+  public:
+    bool encode(const T &input, range_appender &w) override final {
+        typename Transformer::Output tmp;
+        if (!t.apply(input, tmp)) {
+            return false;
+        }
+        return c.encode(tmp, w);
+    }
+
+    bool decode(range_stream &r, T &out) override final {
+        typename Transformer::Output tmp;
+        if (!c.decode(r, tmp)) {
+            return false;
+        }
+        return t.invert(tmp, out);
+    }
+};
+
+/// Range codes the output of a fixed width `bit_appender` coder as direct bits. Allows
+/// members that do not benefit from modelling to share a range coded message.
+template <typename Coder>
+struct range_bits final : public range_transcode_base<typename Coder::Item> {
+  private:
+    static_assert(
+        std::is_base_of<transcode_base<typename Coder::Item>, Coder>::value,
+        "Coder is not a transcoder");
+    static_assert(Coder::bit_size > 0, "Coder must have a fixed bit size");
+    using T = typename Coder::Item;
+    static constexpr size_t bit_size = Coder::bit_size;
+    static constexpr size_t byte_size = (bit_size + CHAR_BIT - 1) / CHAR_BIT;
+    Coder c{};
+    std::vector<uint8_t> buffer;
+
+  public:
+    bool encode(const T &input, range_appender &w) override final {
+        buffer.clear();
+        bit_appender bits(buffer, 0);
+        if (!c.encode(input, bits)) {
+            return false;
+        }
+        for (size_t i = 0; i < byte_size; ++i) {
+            const size_t nbits = std::min(bit_size - i * CHAR_BIT, static_cast<size_t>(CHAR_BIT));
+            w.encode_direct(buffer[i], nbits);
+        }
+        return true;
+    }
+
+    bool decode(range_stream &r, T &out) override final {
+        buffer.resize(byte_size);
+        for (size_t i = 0; i < byte_size; ++i) {
+            const size_t nbits = std::min(bit_size - i * CHAR_BIT, static_cast<size_t>(CHAR_BIT));
+            buffer[i] = static_cast<uint8_t>(r.decode_direct(nbits));
+        }
+        bit_stream bits(buffer, bit_size);
+        return c.decode(bits, out) && r.ok();
+    }
+};
+
+/// Adaptive coder for residuals such as the output of `integer_delta_transform`. The
+/// magnitude class (number of significant bits) is coded with an adaptive bit tree, then
+/// the sign and the top mantissa bits are coded with probabilities conditioned on the
+/// magnitude class. The remaining low mantissa bits are close to uniform and are coded
+/// as direct bits.
+template <
+    typename T,
+    std::enable_if_t<std::is_integral<T>::value, int> = 0>
+struct adaptive_residual final : public range_transcode_base<T> {
+  private:
+    using unsigned_type = typename std::make_unsigned<T>::type;
+    static constexpr size_t max_bits = sizeof(T) * CHAR_BIT;
+    /// Number of mantissa bits below the leading one that are modelled
+    static constexpr size_t modelled_bits = 2;
+
+    range_model::bit_tree<7> magnitude;
+    std::array<range_model::adaptive_bit, max_bits + 1> sign{};
+    std::array<range_model::bit_tree<modelled_bits>, max_bits + 1> mantissa{};
+
+  public:
+    bool encode(const T &input, range_appender &w) override final {
+        const bool negative = std::is_signed<T>::value && input < 0;
+        unsigned_type value = static_cast<unsigned_type>(input);
+        if (negative) {
+            value = static_cast<unsigned_type>(0 - value);
+        }
+        const size_t k = value == 0 ? 0 : detail::significant_bits(value);
+        magnitude.encode(w, static_cast<uint32_t>(k));
+        if (k == 0) {
+            return true;
+        }
+        if (std::is_signed<T>::value) {
+            w.encode_bit(sign[k], negative ? 1 : 0);
+        }
+        // bits below the leading one
+        const size_t remaining = k - 1;
+        const size_t modelled = std::min(remaining, modelled_bits);
+        const size_t direct = remaining - modelled;
+        const auto top = static_cast<uint32_t>((value >> direct) & ((1u << modelled) - 1));
+        // Shift the modelled bits up so short mantissas share the top of the tree
+        mantissa[k].encode(w, top << (modelled_bits - modelled));
+        w.encode_direct(static_cast<uint64_t>(value), direct);
+        return true;
+    }
+
+    bool decode(range_stream &r, T &out) override final {
+        const size_t k = magnitude.decode(r);
+        if (k > max_bits) {
+            return false;
+        }
+        if (k == 0) {
+            out = 0;
+            return r.ok();
+        }
+        bool negative = false;
+        if (std::is_signed<T>::value) {
+            negative = r.decode_bit(sign[k]) != 0;
+        }
+        const size_t remaining = k - 1;
+        const size_t modelled = std::min(remaining, modelled_bits);
+        const size_t direct = remaining - modelled;
+        const uint32_t top = mantissa[k].decode(r) >> (modelled_bits - modelled);
+        uint64_t value = static_cast<uint64_t>(1) << remaining;
+        value |= static_cast<uint64_t>(top) << direct;
+        value |= r.decode_direct(direct);
+        auto result = static_cast<unsigned_type>(value);
+        if (negative) {
+            result = static_cast<unsigned_type>(0 - result);
+        }
+        out = static_cast<T>(result);
+        return r.ok();
+    }
+};
+
+template <typename T, T ptr, typename Coder>
+struct range_struct_member;
+
+/// Represents a member in the struct, and how it should be range coded
+template <typename T, typename S, T S::*ptr, typename Coder>
+struct range_struct_member<T S::*, ptr, Coder> {
+    static_assert(
+        std::is_base_of<range_transcode_base<typename Coder::Item>, Coder>::value,
+        "Coder is not a range transcoder");
+    static_assert(
+        std::is_same<T, typename Coder::Item>::value,
+        "Coder is incompatible with member");
+};
+
+#define MAKE_RANGE_STRUCT_MEMBER(ptr, ...) range_struct_member<decltype(ptr), ptr, __VA_ARGS__>
+
+/// Range code a C++ struct according to `Spec`. `Spec` must be a list of
+/// range_struct_members. Each member picks its own coder, e.g. `range_integer_delta` for
+/// predictable fields and `range_bits` for the rest.
+template <typename T, typename... Spec>
+struct range_struct_coder;
+
+/// ditto
+template <typename T>
+struct range_struct_coder<T> : public range_transcode_base<T> {
+  public:
+    bool encode(const T &input, range_appender &w) override final {
+        return true;
+    }
+    bool decode(range_stream &r, T &output) override final {
+        return true;
+    }
+};
+
+/// ditto
+template <typename T, typename S, typename Coder, S T::*ptr, typename... Rest>
+struct range_struct_coder<T, range_struct_member<S T::*, ptr, Coder>, Rest...> final
+    : public range_transcode_base<T> {
+  private:
+    Coder c;
+    range_struct_coder<T, Rest...> rest;
+
+  public:
+    bool encode(const T &input, range_appender &w) override final {
+        if (!c.encode(input.*ptr, w)) {
+            return false;
+        }
+        return rest.encode(input, w);
+    }
+    bool decode(range_stream &r, T &out) override final {
+        if (!c.decode(r, out.*ptr)) {
+            return false;
+        }
+        return rest.decode(r, out);
+    }
+};
+
+/// Range coded counterpart of `unbounded_integer_delta`
+template <typename T>
+using range_integer_delta = range_transform_coder<
+    T,
+    transform_compose<as_uint64<T>, integer_delta_transform<uint64_t>>,
+    adaptive_residual<int64_t>>;
+
+/// Range coded counterpart of `scaled_fixed_point_delta`
+template <typename T, int64_t Scale>
+using range_fixed_point_delta = range_transform_coder<
+    T,
+    transform_compose<
+        scale<T, Scale>,
+        transform_compose<
+            transform_compose<to_integer<T, int64_t>, as_uint64<int64_t>>,
+            integer_delta_transform<uint64_t>>>,
+    adaptive_residual<int64_t>>;
+
+} // namespace transcode
+} // namespace netcode
+} // namespace aether
@@ -677,6 +677,89 @@ using clamped_fixed_point = transform_coder<
     scale<T, Scale>,
     transform_coder<T, to_integer<T, int64_t>, clamped_int<int64_t, Lower, Upper>>>;
 
+namespace detail {
+
+/// Maps integers onto uint64_t so that values of small magnitude have few significant
+/// bits. Signed values are zig-zag encoded, unsigned values are passed through.
+template <typename T>
+struct varint_mapping {
+    static uint64_t to_u64(const T& v) {
+        if (std::is_unsigned<T>::value) {
+            return static_cast<uint64_t>(v);
+        } else {
+            const auto v_i64 = static_cast<int64_t>(v);
+            const uint64_t sign = v_i64 < 0 ? 1 : 0;
+            auto v_u64 = static_cast<uint64_t>(v);
+            if (sign > 0) {
+                v_u64 = 0 - v_u64 - 1;
+            }
+            v_u64 = (v_u64 << 1) | sign;
+            return v_u64;
+        }
+    }
+
+    static T from_u64(const uint64_t v) {
+        if (std::is_unsigned<T>::value) {
+            return static_cast<T>(v);
+        } else {
+            uint64_t v_u64 = v;
+            const auto sign = v_u64 & 1;
+            v_u64 = v_u64 >> 1;
+            if (sign) {
+                v_u64 = 0 - v_u64 - 1;
+            }
+            auto v_i64 = static_cast<int64_t>(v_u64);
+            return static_cast<T>(v_i64);
+        }
+    }
+};
+
+/// Number of significant bits in `v` (at least 1)
+inline size_t significant_bits(uint64_t v) {
+#if defined(__GNUC__)
+    return sizeof(v) * CHAR_BIT - __builtin_clzll(v | 1);
+#else
+    size_t bits = 1;
+    while (v >>= 1) {
+        ++bits;
+    }
+    return bits;
+#endif
+}
+
+/// Number of trailing zero bits in a non-zero byte
+inline size_t trailing_zeros(const uint8_t v) {
+    assert(v != 0);
+#if defined(__GNUC__)
+    return __builtin_ctz(v);
+#else
+    size_t zeros = 0;
+    while (((v >> zeros) & 1) == 0) {
+        ++zeros;
+    }
+    return zeros;
+#endif
+}
+
+/// Number of bytes needed to hold the significant bits of `v` (at least 1)
+inline size_t significant_bytes(const uint64_t v) {
+    return (significant_bits(v) + CHAR_BIT - 1) / CHAR_BIT;
+}
+
+/// Little-endian load of `nbytes` (at most 8) bytes. Always reads 8 bytes so the copy
+/// has a fixed size, so `data` must have 8 readable bytes.
+inline uint64_t load_le(const uint8_t *data, const size_t nbytes) {
+    assert(nbytes <= sizeof(uint64_t));
+    uint64_t result;
+    std::memcpy(&result, data, sizeof(result));
+    if (nbytes < sizeof(result)) {
+        result &= (static_cast<uint64_t>(1) << (nbytes * CHAR_BIT)) - 1;
+    }
+    return result;
+}
+
+}
+
 /// Encodes a integer using a variable length encoding
 template <
     typename T,
@@ -686,7 +769,7 @@ struct variable_int final : public transcode_base<T> {
     static const size_t bit_size = 0;
 
     bool encode(const T &_input, bit_appender &w) override final {
-        uint64_t input = to_u64(_input);
+        uint64_t input = detail::varint_mapping<T>::to_u64(_input);
         std::array<unsigned char, 10> encoded;
         size_t length = 0;
         do {
@@ -715,49 +798,187 @@ struct variable_int final : public transcode_base<T> {
             output |= (static_cast<uint64_t>(current & 127) << offset);
             offset += 7;
         } while ((current & 128) != 0);
-        out = from_u64(output);
+        out = detail::varint_mapping<T>::from_u64(output);
         return true;
     }
+};
 
-private:
-    static uint64_t to_u64(const T& v) {
-        if (std::is_unsigned<T>::value) {
-            return static_cast<uint64_t>(v);
+/// Encodes a integer using a prefix varint. The number of trailing zero bits in the
+/// first byte gives the number of bytes that follow it, so a value is decoded with two
+/// reads from the bit_stream rather than one read per byte as in `variable_int`.
+///
+/// A value with at most 7 * n significant bits takes n bytes (1 <= n <= 8). Larger values
+/// are written as a zero byte followed by the 8 raw bytes of the value.
+template <
+    typename T,
+    std::enable_if_t<std::is_integral<T>::value, int> = 0>
+struct prefix_varint final : public transcode_base<T> {
+    // This is invalid since the compile-time size of the encoding is unknown
+    static const size_t bit_size = 0;
+
+    bool encode(const T &_input, bit_appender &w) override final {
+        const uint64_t input = detail::varint_mapping<T>::to_u64(_input);
+        const size_t length = (detail::significant_bits(input) + 6) / 7;
+        std::array<uint8_t, 9> encoded;
+        if (length <= 8) {
+            // The tag and value share a 64-bit word since 7 * 8 + 8 == 64
+            const uint64_t word = (input << length) | (static_cast<uint64_t>(1) << (length - 1));
+            std::memcpy(&encoded[0], &word, sizeof(word));
+            w.push_bits(&encoded[0], length * CHAR_BIT);
         } else {
-            const auto v_i64 = static_cast<int64_t>(v);
-            const uint64_t sign = v_i64 < 0 ? 1 : 0;
-            auto v_u64 = static_cast<uint64_t>(v);
-            if (sign > 0) {
-                v_u64 = 0 - v_u64 - 1;
-            }
-            v_u64 = (v_u64 << 1) | sign;
-            return v_u64;
+            encoded[0] = 0;
+            std::memcpy(&encoded[1], &input, sizeof(input));
+            w.push_bits(&encoded[0], encoded.size() * CHAR_BIT);
         }
+        return true;
     }
 
-    static T from_u64(const uint64_t v) {
-        if (std::is_unsigned<T>::value) {
-            return static_cast<T>(v);
+    bool decode(bit_stream &r, T &out) override final {
+        std::array<uint8_t, 9> encoded{};
+        if (r.get_bits(&encoded[0], CHAR_BIT) != CHAR_BIT) {
+            return false;
+        }
+        const uint8_t tag = encoded[0];
+        if ((tag & 1) != 0) {
+            out = detail::varint_mapping<T>::from_u64(tag >> 1);
+            return true;
+        }
+        // 9 for a zero tag, otherwise 1 + number of trailing zeros
+        const size_t length = tag == 0 ? encoded.size() : detail::trailing_zeros(tag) + 1;
+        const size_t remaining_bits = (length - 1) * CHAR_BIT;
+        if (r.get_bits(&encoded[1], remaining_bits) != remaining_bits) {
+            return false;
+        }
+        uint64_t output;
+        if (tag == 0) {
+            output = detail::load_le(&encoded[1], sizeof(output));
         } else {
-            uint64_t v_u64 = v;
-            const auto sign = v_u64 & 1;
-            v_u64 = v_u64 >> 1;
-            if (sign) {
-                v_u64 = 0 - v_u64 - 1;
+            output = detail::load_le(&encoded[0], length) >> length;
+        }
+        out = detail::varint_mapping<T>::from_u64(output);
+        return true;
+    }
+};
+
+/// Encodes four integers at a time using a group varint. A control byte holds four
+/// 2-bit length codes, followed by the values packed into their significant bytes. The
+/// lengths come from a table lookup and all four values are fetched from the bit_stream
+/// with a single read, so decoding has no per-byte loop.
+///
+/// Types of up to 32 bits use lengths of 1-4 bytes; 64-bit types use 1, 2, 4 or 8 bytes.
+template <
+    typename T,
+    std::enable_if_t<std::is_integral<T>::value, int> = 0>
+struct group_varint final : public transcode_base<std::array<T, 4>> {
+    using group_type = std::array<T, 4>;
+    // This is invalid since the compile-time size of the encoding is unknown
+    static const size_t bit_size = 0;
+
+  private:
+    static constexpr bool wide = sizeof(T) > sizeof(uint32_t);
+    static constexpr std::array<uint8_t, 4> lengths = wide ?
+        std::array<uint8_t, 4>{{1, 2, 4, 8}} : std::array<uint8_t, 4>{{1, 2, 3, 4}};
+    static constexpr size_t max_group_bytes = 4 * lengths[3];
+
+    static uint8_t length_code(const uint64_t v) {
+        const size_t bytes = detail::significant_bytes(v);
+        if (wide) {
+            return static_cast<uint8_t>((bytes > 1) + (bytes > 2) + (bytes > 4));
+        } else {
+            return static_cast<uint8_t>(bytes - 1);
+        }
+    }
+
+  public:
+    bool encode(const group_type &input, bit_appender &w) override final {
+        std::array<uint8_t, 1 + max_group_bytes + sizeof(uint64_t)> encoded;
+        uint8_t control = 0;
+        size_t offset = 1;
+        for (size_t i = 0; i < input.size(); ++i) {
+            const uint64_t value = detail::varint_mapping<T>::to_u64(input[i]);
+            const uint8_t code = length_code(value);
+            control |= static_cast<uint8_t>(code << (2 * i));
+            std::memcpy(&encoded[offset], &value, sizeof(value));
+            offset += lengths[code];
+        }
+        encoded[0] = control;
+        w.push_bits(&encoded[0], offset * CHAR_BIT);
+        return true;
+    }
+
+    bool decode(bit_stream &r, group_type &out) override final {
+        uint8_t control;
+        if (r.get_bits(&control, CHAR_BIT) != CHAR_BIT) {
+            return false;
+        }
+        std::array<size_t, 4> value_lengths;
+        size_t total = 0;
+        for (size_t i = 0; i < value_lengths.size(); ++i) {
+            value_lengths[i] = lengths[(control >> (2 * i)) & 3];
+            total += value_lengths[i];
+        }
+        // Padded so every value can be loaded with a fixed size copy
+        std::array<uint8_t, max_group_bytes + sizeof(uint64_t)> encoded{};
+        if (r.get_bits(&encoded[0], total * CHAR_BIT) != total * CHAR_BIT) {
+            return false;
+        }
+        size_t offset = 0;
+        for (size_t i = 0; i < out.size(); ++i) {
+            const uint64_t value = detail::load_le(&encoded[offset], value_lengths[i]);
+            out[i] = detail::varint_mapping<T>::from_u64(value);
+            offset += value_lengths[i];
+        }
+        return true;
+    }
+};
+
+/// Applies `Transformer` to each element of an array. Lets element-wise transforms such
+/// as `integer_delta_transform` feed block coders like `group_varint`.
+template <typename Transformer, size_t N>
+struct elementwise_transform : public transform_base<
+    std::array<typename Transformer::Input, N>,
+    std::array<typename Transformer::Output, N>> {
+    using input_type = std::array<typename Transformer::Input, N>;
+    using output_type = std::array<typename Transformer::Output, N>;
+
+    Transformer t{};
+
+    bool apply(const input_type &input, output_type &output) override final {
+        for (size_t i = 0; i < N; ++i) {
+            if (!t.apply(input[i], output[i])) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool invert(const output_type &input, input_type &output) override final {
+        for (size_t i = 0; i < N; ++i) {
+            if (!t.invert(input[i], output[i])) {
+                return false;
             }
-            auto v_i64 = static_cast<int64_t>(v_u64);
-            return static_cast<T>(v_i64);
         }
+        return true;
     }
 };
 
-template <typename T>
+/// Delta-encodes integers. `Coder` may be any integer coder over int64_t, e.g.
+/// `variable_int` or `prefix_varint`.
+template <typename T, typename Coder = variable_int<int64_t>>
 using unbounded_integer_delta = transform_coder<
     T,
     transform_compose<as_uint64<T>, integer_delta_transform<uint64_t>>,
-    variable_int<int64_t>>;
+    Coder>;
 
-template <typename T, int64_t Scale>
+/// Delta-encodes groups of four integers with a `group_varint`. Each lane keeps its own
+/// delta state, so it suits columns that advance together (e.g. 4 entity ids at a time).
+template <typename T>
+using unbounded_integer_delta_group = transform_coder<
+    std::array<T, 4>,
+    elementwise_transform<transform_compose<as_uint64<T>, integer_delta_transform<uint64_t>>, 4>,
+    group_varint<int64_t>>;
+
+template <typename T, int64_t Scale, typename Coder = variable_int<int64_t>>
 using scaled_fixed_point_delta = transform_coder<
     T,
     scale<T, Scale>,
@@ -766,7 +987,7 @@ using scaled_fixed_point_delta = transform_coder<
         transform_compose<
             transform_compose<to_integer<T, int64_t>, as_uint64<int64_t>>,
             integer_delta_transform<uint64_t>>,
-        variable_int<int64_t>>>;
+        Coder>>;
 
 } // namespace transcode
 } // namespace netcode
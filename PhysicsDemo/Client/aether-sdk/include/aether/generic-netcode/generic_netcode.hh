@@ -26,7 +26,6 @@ namespace aether {
 
 namespace netcode {
 
-static constexpr size_t HISTORY_SIZE = 1;
 static constexpr double MIN_SIMULATION_HZ = 5.0f;
 
 static vec3f promote_to_vec3f(const vec3f &pos) {
@@ -89,6 +88,10 @@ private:
     struct scheduled_entity_info {
         int64_t bucket_id;
         std::optional<uint64_t> last_sent_tick;
+        // With dead reckoning, the state the client is extrapolating and the time
+        // the muxer received it
+        std::optional<entity_type> last_sent;
+        time_point last_sent_time;
     };
 
     void *conn_ctx; //! Opaque connection context
@@ -116,6 +119,10 @@ private:
     //! Pops a worker_id for any workers whose headers should be sent
     std::optional<uint64_t> pop_best_per_worker(const time_point &now);
 
+    //! Returns true if the client's extrapolation of the entity is still within the
+    //! prediction tolerance of the interest policy, so its latest state need not be sent
+    bool is_predicted(const entity_store<entity_type> &store, const entity_handle &handle) const;
+
 public:
     connection_state(void *_conn_ctx, const generic_interest_policy &policy, entity_store<entity_type> &global_store);
     connection_state(connection_state&&) = default;
@@ -185,8 +192,8 @@ private:
     uint64_t latest_tick = 0;
     std::unordered_map<uint64_t, connection_state<marshalling_type>> connection_states;
     std::unordered_map<uint64_t, worker_state<marshalling_type>> worker_states;
-    entity_store<entity_type> entity_store;
-    spatial_index<decltype(entity_store)> spatial_index;
+    aether::netcode::entity_store<entity_type> entity_store;
+    aether::netcode::spatial_index<decltype(entity_store)> spatial_index;
     controlled_entity_map controlled_entities;
     marshalling_type marshalling_factory;
     generic_interest_policy interest_policy;
@@ -344,7 +351,8 @@ void generic_netcode<Marshaller>::process_payload(void *muxer, uint64_t worker_i
 
 template<typename Marshaller>
 void generic_netcode<Marshaller>::prune() {
-    const uint64_t min_tick = latest_tick > HISTORY_SIZE ? latest_tick - HISTORY_SIZE : 0;
+    const uint64_t history = interest_policy.entity_history_ticks;
+    const uint64_t min_tick = latest_tick > history ? latest_tick - history : 0;
 
     // Prune dead controlled entities
     for(auto &[_, player_entities] : controlled_entities) {
@@ -601,22 +609,33 @@ void connection_state<Marshalling>::notify_writable(void *muxer,
                         drop_entities_spatial.update_entity(h_entity);
                     }
                 }
-                // Only send the entity if it has changed or it will be dropped
-                if (!next_time ||
-                    std::optional<uint64_t>(store.last_updated_tick(h_entity)) != last_sent_tick(h_entity)) {
+                // Only send the entity if it has changed or it will be dropped, and skip
+                // changes the client can extrapolate. Skipped changes leave the last sent
+                // tick alone so that the next one is checked against what the client has.
+                const bool changed =
+                    std::optional<uint64_t>(store.last_updated_tick(h_entity)) != last_sent_tick(h_entity);
+                const bool predicted = next_time && changed && is_predicted(store, h_entity);
+                if (!next_time || (changed && !predicted)) {
                     marshaller.add_entity(entity);
                     // Ensure the header for the worker associated with this entity
                     // is up to date.
                     worker_headers_to_send.insert(store.last_worker(h_entity));
                 }
+                schedule_entity(store, h_entity, next_time, !predicted);
+                if (next_time && changed && !predicted && interest_policy.prediction_tolerance > 0.0f) {
+                    auto &info = scheduled_entities.at(h_entity.get_id());
+                    info.last_sent = { entity };
+                    info.last_sent_time = store.last_updated_time(h_entity);
+                }
+                has_useful_data = has_useful_data || !predicted;
             } else {
                 // the entity is not valid anymore. This means it is dead.
                 entity_type dead_entity;
                 synthesize_dead_entity(store.get_entity_id(h_entity), dead_entity);
                 marshaller.add_entity(dead_entity);
+                has_useful_data = true;
+                schedule_entity(store, h_entity, next_time, true);
             }
-            has_useful_data = true;
-            schedule_entity(store, h_entity, next_time, true);
         }
     }
     drop_entities_spatial.commit();
@@ -684,6 +703,21 @@ std::optional<uint64_t> connection_state<Marshalling>::pop_best_bucket(const tim
     return bucket_idx;
 }
 
+template<typename Marshalling>
+bool connection_state<Marshalling>::is_predicted(const entity_store<entity_type> &store, const entity_handle &handle) const {
+    if (interest_policy.prediction_tolerance <= 0.0f) { return false; }
+    const auto scheduled_iter = scheduled_entities.find(handle.get_id());
+    if (scheduled_iter == scheduled_entities.end() || !scheduled_iter->second.last_sent.has_value()) {
+        return false;
+    }
+    const auto &info = scheduled_iter->second;
+    const auto elapsed = store.last_updated_time(handle) - info.last_sent_time;
+    if (elapsed >= interest_policy.prediction_keepalive) { return false; }
+    const float elapsed_seconds = std::chrono::duration<float>(elapsed).count();
+    const std::optional<float> error = get_prediction_error(info.last_sent.value(), store.get(handle), elapsed_seconds);
+    return error.has_value() && error.value() <= interest_policy.prediction_tolerance;
+}
+
 template<typename Marshalling>
 std::optional<uint64_t> connection_state<Marshalling>::pop_best_per_worker(const time_point &now) {
     const auto top = worker_send_priorities.peek();
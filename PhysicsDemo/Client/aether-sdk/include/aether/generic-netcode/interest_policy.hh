@@ -1,6 +1,7 @@
 #pragma once
 #include <vector>
 #include <chrono>
+#include <cstdint>
 #include <limits>
 #include <tuple>
 
@@ -13,6 +14,18 @@ struct generic_interest_policy {
     float per_worker_metadata_frequency_hz = 5.0;
     bool no_player_simulation = true;
 
+    // Dead reckoning. Clients extrapolate entities at the velocity they were last sent
+    // with, so a change is not resent while the extrapolated position stays within
+    // prediction_tolerance world units of the real one. Zero resends every change.
+    float prediction_tolerance = 0.0;
+    // Entities held back by prediction_tolerance are still resent this often
+    std::chrono::milliseconds prediction_keepalive{1000};
+
+    // Ticks an entity is kept after the last simulation message that contained it. A
+    // simulation that sends unchanged entities only at a keepalive rate needs this to
+    // cover the keepalive interval, or they are dropped in between.
+    uint64_t entity_history_ticks = 1;
+
     enum class gradient_type {
         constant,
         linear,
@@ -73,6 +86,15 @@ struct generic_interest_policy {
         return !no_player_simulation;
     }
 
+    void set_prediction(const float tolerance, const std::chrono::milliseconds keepalive) {
+        prediction_tolerance = tolerance;
+        prediction_keepalive = keepalive;
+    }
+
+    void set_entity_history(const uint64_t ticks) {
+        entity_history_ticks = ticks;
+    }
+
     float get_cut_off() const {
         if (rings.empty()) {
             return 0.0;
@@ -1,8 +1,13 @@
 #pragma once
 #include <aether/common/io/in_memory.hh>
+#include <aether/common/netcode/transcode.hh>
 #include "marshalling.hh"
+#include <algorithm>
 #include <cassert>
+#include <climits>
 #include <cstdint>
+#include <cstring>
+#include <numeric>
 #include <unordered_map>
 #include <optional>
 #include <type_traits>
@@ -14,12 +19,28 @@ namespace netcode {
 namespace detail {
 
 static const uint64_t TRIVIAL_MARSHALLER_MAGIC = 0x251f2c5fc5d019d6ull;
-static const uint16_t TRIVIAL_MARSHALLER_VERSION = 0;
+// Version 1 added sorted_entity_data. Older messages are still decodable. Messages
+// without a sorted_entity_data blob are written as version 0, so that decoders that
+// predate it can still read them.
+static const uint16_t TRIVIAL_MARSHALLER_VERSION = 1;
+static const uint16_t TRIVIAL_MARSHALLER_BASE_VERSION = 0;
 
 enum class blob_type : unsigned char {
     static_data,
     worker_data,
     entity_data,
+    // Entities sorted by id. The id column is written separately and elided from
+    // each record.
+    sorted_entity_data,
+};
+
+// How the id column of a sorted_entity_data blob is encoded
+enum class id_encoding : unsigned char {
+    // variable_int deltas between consecutive ids
+    delta,
+    // a base id followed by a bitset of which ids in [base, base + 8 * size) are present.
+    // Only used when ids are unique and dense.
+    bitset,
 };
 
 struct blob_header {
@@ -41,6 +62,10 @@ private:
     std::optional<static_data_type> static_data;
     std::vector<entity_type> entities;
     std::unordered_map<uint64_t, per_worker_data_type> worker_data;
+    bool sorted_id_blocks;
+
+    static constexpr size_t id_offset = get_entity_id_offset(entity_type{});
+    static constexpr size_t record_size = sizeof(entity_type) - sizeof(uint64_t);
 
     template<typename Writer>
     static int write_header(Writer &writer, const detail::blob_header &header) {
@@ -53,7 +78,75 @@ private:
         return ret;
     }
 
+    // Encodes the sorted ids as deltas and, if they are unique, as a bitset and returns
+    // whichever is smaller
+    static detail::id_encoding encode_ids(const std::vector<uint64_t> &ids, std::vector<uint8_t> &encoded) {
+        encoded.clear();
+        transcode::unbounded_integer_delta<uint64_t> coder;
+        transcode::bit_appender appender(encoded, 0);
+        for(const auto id : ids) {
+            coder.encode(id, appender);
+        }
+
+        if (ids.empty() || std::adjacent_find(ids.begin(), ids.end()) != ids.end()) {
+            return detail::id_encoding::delta;
+        }
+        const uint64_t base = ids.front();
+        // Ids spread wider than the deltas' bits can not make a smaller bitset. Checking
+        // first keeps the span and size below from overflowing.
+        if (ids.back() - base >= encoded.size() * CHAR_BIT) {
+            return detail::id_encoding::delta;
+        }
+        const uint64_t span = ids.back() - base + 1;
+        const uint64_t bitset_size = sizeof(base) + (span + 7) / 8;
+        if (bitset_size >= encoded.size()) {
+            return detail::id_encoding::delta;
+        }
+
+        encoded.assign(bitset_size, 0);
+        std::memcpy(encoded.data(), &base, sizeof(base));
+        uint8_t *const bits = encoded.data() + sizeof(base);
+        for(const auto id : ids) {
+            const uint64_t bit = id - base;
+            bits[bit / 8] |= static_cast<uint8_t>(1u << (bit % 8));
+        }
+        return detail::id_encoding::bitset;
+    }
+
+    template<typename Writer>
+    void write_sorted_entities(Writer &writer) const {
+        std::vector<size_t> order(entities.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [this](const size_t a, const size_t b) {
+            return get_entity_id(entities[a]) < get_entity_id(entities[b]);
+        });
+
+        std::vector<uint64_t> ids;
+        ids.reserve(order.size());
+        for(const auto index : order) {
+            ids.push_back(get_entity_id(entities[index]));
+        }
+
+        std::vector<uint8_t> encoded_ids;
+        const detail::id_encoding encoding = encode_ids(ids, encoded_ids);
+        const uint32_t encoded_size = encoded_ids.size();
+        write_all(writer, &encoding, sizeof(encoding));
+        write_all(writer, &encoded_size, sizeof(encoded_size));
+        write_all(writer, encoded_ids.data(), encoded_ids.size());
+
+        for(const auto index : order) {
+            const auto *const bytes = reinterpret_cast<const char *>(&entities[index]);
+            write_all(writer, bytes, id_offset);
+            write_all(writer, bytes + id_offset + sizeof(uint64_t), sizeof(entity_type) - id_offset - sizeof(uint64_t));
+        }
+    }
+
 public:
+    /// @param _sorted_id_blocks sort entities by id and write the ids as a compact
+    /// column rather than in every record
+    explicit trivial_marshaller(const bool _sorted_id_blocks = false) : sorted_id_blocks(_sorted_id_blocks) {
+    }
+
     void set_static_data(const static_data_type &data) override {
         static_data = data;
     }
@@ -74,7 +167,8 @@ public:
         std::vector<char> data;
         in_memory_writer<char> writer(data);
         write_all(writer, &detail::TRIVIAL_MARSHALLER_MAGIC, sizeof(detail::TRIVIAL_MARSHALLER_MAGIC));
-        write_all(writer, &detail::TRIVIAL_MARSHALLER_VERSION, sizeof(detail::TRIVIAL_MARSHALLER_VERSION));
+        const uint16_t version = sorted_id_blocks ? detail::TRIVIAL_MARSHALLER_VERSION : detail::TRIVIAL_MARSHALLER_BASE_VERSION;
+        write_all(writer, &version, sizeof(version));
 
         const uint16_t num_headers = 3;
         write_all(writer, &num_headers, sizeof(num_headers));
@@ -90,9 +184,14 @@ public:
         blob_header.size = sizeof(uint64_t) + sizeof(per_worker_data_type);
         write_header(writer, blob_header);
 
-        blob_header.type = detail::blob_type::entity_data;
+        if (sorted_id_blocks) {
+            blob_header.type = detail::blob_type::sorted_entity_data;
+            blob_header.size = record_size;
+        } else {
+            blob_header.type = detail::blob_type::entity_data;
+            blob_header.size = sizeof(entity_type);
+        }
         blob_header.count = entities.size();
-        blob_header.size = sizeof(entity_type);
         write_header(writer, blob_header);
 
         if (static_data.has_value()) {
@@ -104,8 +203,12 @@ public:
             write_all(writer, &worker_info, sizeof(worker_info));
         }
 
-        for(const auto &entity : entities) {
-            write_all(writer, &entity, sizeof(entity));
+        if (sorted_id_blocks) {
+            write_sorted_entities(writer);
+        } else {
+            for(const auto &entity : entities) {
+                write_all(writer, &entity, sizeof(entity));
+            }
         }
 
         return data;
@@ -124,6 +227,9 @@ private:
     std::vector<entity_type> entities;
     std::unordered_map<uint64_t, per_worker_data_type> worker_data;
 
+    static constexpr size_t id_offset = get_entity_id_offset(entity_type{});
+    static constexpr size_t record_size = sizeof(entity_type) - sizeof(uint64_t);
+
     template<typename Reader>
     int read_headers(Reader &reader, std::vector<detail::blob_header> &headers) {
         headers.clear();
@@ -148,20 +254,54 @@ private:
         return 0;
     }
 
+    static bool decode_ids(const detail::id_encoding encoding, const std::vector<uint8_t> &encoded,
+        const size_t count, std::vector<uint64_t> &ids) {
+        ids.clear();
+        ids.reserve(count);
+        switch(encoding) {
+            case detail::id_encoding::delta: {
+                transcode::unbounded_integer_delta<uint64_t> coder;
+                transcode::bit_stream stream(encoded, encoded.size() * CHAR_BIT);
+                for(size_t i = 0; i < count; ++i) {
+                    uint64_t id;
+                    if (!coder.decode(stream, id)) { return false; }
+                    ids.push_back(id);
+                }
+                return true;
+            }
+            case detail::id_encoding::bitset: {
+                uint64_t base;
+                if (encoded.size() < sizeof(base)) { return false; }
+                std::memcpy(&base, encoded.data(), sizeof(base));
+                const uint8_t *const bits = encoded.data() + sizeof(base);
+                const size_t num_bits = (encoded.size() - sizeof(base)) * 8;
+                for(size_t bit = 0; bit < num_bits && ids.size() < count; ++bit) {
+                    if ((bits[bit / 8] >> (bit % 8)) & 1) {
+                        ids.push_back(base + bit);
+                    }
+                }
+                return ids.size() == count;
+            }
+            default: {
+                return false;
+            }
+        }
+    }
+
 public:
     bool decode(const void *data, size_t count) override {
         in_memory_reader reader(data, count);
         std::remove_cv<decltype(detail::TRIVIAL_MARSHALLER_MAGIC)>::type magic;
         std::remove_cv<decltype(detail::TRIVIAL_MARSHALLER_VERSION)>::type version;
 
-        read_exact(reader, &magic, sizeof(magic));
+        if (read_exact(reader, &magic, sizeof(magic)) != 0) { return false; }
         assert(magic == detail::TRIVIAL_MARSHALLER_MAGIC && "Data not written using trivial marshaller");
 
-        read_exact(reader, &version, sizeof(version));
-        assert(version == detail::TRIVIAL_MARSHALLER_VERSION && "Decoding using wrong version of trivial marshaller");
+        if (read_exact(reader, &version, sizeof(version)) != 0) { return false; }
+        assert(version <= detail::TRIVIAL_MARSHALLER_VERSION && "Decoding using wrong version of trivial marshaller");
 
         std::vector<detail::blob_header> headers;
-        read_headers(reader, headers);
+        if (read_headers(reader, headers) != 0) { return false; }
 
         for(const auto &header : headers) {
             const size_t count = header.count;
@@ -173,7 +313,7 @@ public:
                     for(size_t i = 0; i < count; ++i) {
                         assert(!static_data.has_value() && "Multiple static datas in message");
                         static_data_type data;
-                        read_exact(reader, &data, sizeof(data));
+                        if (read_exact(reader, &data, sizeof(data)) != 0) { return false; }
                         static_data = { data };
                     }
                     break;
@@ -184,18 +324,64 @@ public:
                     uint64_t worker_id;
                     per_worker_data_type data;
                     for(size_t i = 0; i < count; ++i) {
-                        read_exact(reader, &worker_id, sizeof(worker_id));
-                        read_exact(reader, &data, sizeof(data));
+                        if (read_exact(reader, &worker_id, sizeof(worker_id)) != 0 ||
+                            read_exact(reader, &data, sizeof(data)) != 0) {
+                            return false;
+                        }
                         worker_data[worker_id] = data;
                     }
                     break;
                 }
                 case detail::blob_type::entity_data: {
                     assert(blob_size == sizeof(entity_type) && "Mismatch in entity data size");
+                    if (count > reader.remaining() / sizeof(entity_type)) { return false; }
                     entity_type entity;
                     entities.reserve(count);
                     for(size_t i = 0; i < count; ++i) {
-                        read_exact(reader, &entity, sizeof(entity));
+                        if (read_exact(reader, &entity, sizeof(entity)) != 0) { return false; }
+                        entities.push_back(entity);
+                    }
+                    break;
+                }
+                case detail::blob_type::sorted_entity_data: {
+                    // The sizes come from the message, so they are checked against what is
+                    // left of it before anything is allocated
+                    if (blob_size != record_size) {
+                        assert(false && "Mismatch in sorted entity data size");
+                        return false;
+                    }
+                    detail::id_encoding encoding;
+                    uint32_t encoded_size;
+                    if (read_exact(reader, &encoding, sizeof(encoding)) != 0 ||
+                        read_exact(reader, &encoded_size, sizeof(encoded_size)) != 0) {
+                        return false;
+                    }
+                    // Every id takes at least a bit of the column
+                    if (encoded_size > reader.remaining() ||
+                        count > (reader.remaining() - encoded_size) / record_size ||
+                        count > static_cast<size_t>(encoded_size) * CHAR_BIT) {
+                        return false;
+                    }
+                    std::vector<uint8_t> encoded(encoded_size);
+                    if (read_exact(reader, encoded.data(), encoded.size()) != 0) {
+                        return false;
+                    }
+
+                    std::vector<uint64_t> ids;
+                    if (!decode_ids(encoding, encoded, count, ids)) {
+                        assert(false && "Malformed entity id column");
+                        return false;
+                    }
+
+                    entity_type entity;
+                    auto *const bytes = reinterpret_cast<char *>(&entity);
+                    entities.reserve(entities.size() + count);
+                    for(const auto id : ids) {
+                        if (read_exact(reader, bytes, id_offset) != 0 ||
+                            read_exact(reader, bytes + id_offset + sizeof(uint64_t), sizeof(entity_type) - id_offset - sizeof(uint64_t)) != 0) {
+                            return false;
+                        }
+                        std::memcpy(bytes + id_offset, &id, sizeof(id));
                         entities.push_back(entity);
                     }
                     break;
@@ -231,8 +417,17 @@ public:
     using static_data_type = typename Traits::static_data_type;
     using per_worker_data_type = typename Traits::per_worker_data_type;
 
+private:
+    bool sorted_id_blocks;
+
+public:
+    /// @param _sorted_id_blocks whether marshallers sort entities by id and write the
+    /// ids as a compact column. Demarshallers accept either layout.
+    explicit trivial_marshalling(const bool _sorted_id_blocks = false) : sorted_id_blocks(_sorted_id_blocks) {
+    }
+
     trivial_marshaller<traits_type> create_marshaller() const override {
-        return {};
+        return trivial_marshaller<traits_type>(sorted_id_blocks);
     }
 
     trivial_demarshaller<traits_type> create_demarshaller() const override {
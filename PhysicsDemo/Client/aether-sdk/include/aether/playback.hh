@@ -0,0 +1,107 @@
+#pragma once
+
+#include <aether/common/hadean_platform.hh>
+#include <aether/common/span.hh>
+#include <aether/common/timer.hh>
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace aether {
+
+namespace repclient {
+
+// Plays back a file written by repclient in RECORD mode. Each record in the file is
+//
+//   uint64_t worker_id | float time | uint64_t length | length bytes of message
+//
+// The file is memory mapped copy-on-write where possible and read into memory
+// otherwise, and messages are returned as pointers into it. Recordings compressed by
+// the recorder are decompressed into memory first, which needs AETHER_WITH_ZSTD.
+//
+// An index of record offsets and times is loaded from "<path>.idx" as far as it
+// matches the recording. Any records after it are found by scanning the file, and the
+// index is saved back for next time. A truncated final record, as left by a client
+// that did not shut down cleanly, is ignored.
+class playback {
+public:
+    // Passing this to set_speed() returns records as fast as they are asked for
+    static constexpr double UNTHROTTLED = std::numeric_limits<double>::infinity();
+
+    // Every record starts with its worker id, time and length
+    static constexpr size_t RECORD_HEADER_SIZE = sizeof(uint64_t) + sizeof(float) + sizeof(uint64_t);
+
+    // The index file is INDEX_MAGIC followed by a (uint64_t offset, float time) pair
+    // per record. Offsets are into the uncompressed recording.
+    static constexpr uint64_t INDEX_MAGIC = 0x3158444950485441; // "ATHPIDX1"
+
+    struct index_entry {
+        uint64_t offset;
+        float time;
+    };
+
+    static std::string get_index_path(const std::string &recording_path);
+
+    explicit playback(const char *path);
+    playback(const playback &) = delete;
+    playback &operator=(const playback &) = delete;
+    ~playback();
+
+    // Returns the next record if it is due, or nullptr if it is not or the recording
+    // has ended. The returned message stays valid as long as this object.
+    void *next(uint64_t *worker_id, uint64_t *length, float *time);
+
+    // Positions playback at the first record at or after the given recording time
+    void seek(double seconds);
+
+    // Plays back at multiplier times the recorded rate
+    void set_speed(double multiplier);
+
+    double get_speed() const;
+
+    // The recording time playback has reached
+    double position() const;
+
+    // The time of the last record
+    double duration() const;
+
+    size_t size() const;
+
+    bool at_end() const;
+
+    span<const index_entry> get_index() const;
+
+private:
+    std::string path;
+    uint8_t *file_data = nullptr;
+    size_t file_size = 0;
+    bool mapped = false;
+#if defined(_WIN32)
+    void *file_handle = nullptr;
+    void *mapping_handle = nullptr;
+#endif
+    // Holds the file when it could not be mapped or was compressed
+    std::vector<uint8_t> file_copy;
+    std::vector<index_entry> index;
+
+    size_t cursor = 0;
+    double speed = 1.0;
+    // Recording time at clock_start
+    double base_time = 0.0;
+    timer::time_type clock_start {};
+
+    void map_file();
+    void unmap_file();
+    void decompress_file();
+    void load_index();
+    void build_index();
+    void save_index() const;
+    void restart_clock(double recording_time);
+};
+
+}
+
+}
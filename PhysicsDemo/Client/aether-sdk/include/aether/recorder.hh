@@ -0,0 +1,90 @@
+#pragma once
+
+#include <aether/common/hadean_platform.hh>
+#include <aether/playback.hh>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace aether {
+
+namespace repclient {
+
+struct recorder_options {
+    // Compresses the recording with zstd. This needs AETHER_WITH_ZSTD and is ignored
+    // with a warning otherwise.
+    bool compress = false;
+    // Records are gathered into blocks of about this many bytes before being written
+    size_t block_size = 1 << 20;
+    // Full blocks that may wait for the writer thread before records are dropped
+    size_t max_queued_blocks = 8;
+};
+
+// Writes the file that playback reads, without blocking the caller on I/O. Records
+// are copied into the current block, and full blocks are written by a background
+// thread together with their "<path>.idx" index entries. If the writer thread falls
+// behind by more than max_queued_blocks, records are dropped and counted rather than
+// stalling the caller.
+//
+// Each block is flushed as it is written, so a recording cut short by a crash is
+// readable up to the last written block.
+class recorder {
+public:
+    explicit recorder(const char *path, const recorder_options &options = recorder_options());
+    recorder(const recorder &) = delete;
+    recorder &operator=(const recorder &) = delete;
+    // Writes out all appended records
+    ~recorder();
+
+    // Returns false if the record was dropped
+    bool append(uint64_t worker_id, float time, const void *data, uint64_t length);
+
+    // Records dropped because the writer thread fell behind
+    uint64_t get_dropped() const;
+
+    // Records that have been written and flushed
+    uint64_t get_written() const;
+
+private:
+    struct block {
+        std::vector<uint8_t> data;
+        std::vector<playback::index_entry> index;
+    };
+
+    static void do_writes(recorder &);
+
+    recorder_options options;
+    FILE *file = nullptr;
+    FILE *index_file = nullptr;
+
+    // Only touched by the appending thread
+    std::unique_ptr<block> current;
+    uint64_t offset = 0;
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<std::unique_ptr<block>> queued;
+    std::vector<std::unique_ptr<block>> spare;
+    bool closing = false;
+
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<uint64_t> written{0};
+    std::thread writer_thread;
+
+    // Hands the current block to the writer thread. Returns false if too many
+    // blocks are already queued.
+    bool submit();
+};
+
+}
+
+}
@@ -10,16 +10,27 @@
 #error unknown compiler
 #endif
 
+// On Linux the live connection is serviced by a single epoll event loop. Defining
+// AETHER_REPCLIENT_THREADED selects the portable send/receive thread pair instead,
+// which is always used on Windows.
+#if defined(__linux__) && !defined(AETHER_REPCLIENT_THREADED)
+#define AETHER_REPCLIENT_EPOLL 1
+#endif
+
 #include <aether/common/hadean_platform.hh>
 #include <aether/common/container/ring_buffer.hh>
+#include <aether/common/container/spsc_ring_buffer.hh>
 #include <aether/common/tcp.hh>
 #include <aether/common/timer.hh>
 #include <aether/common/client_message.hh>
+#include <aether/playback.hh>
+#include <aether/recorder.hh>
 
 #include <atomic>
 #include <condition_variable>
 #include <cstdint>
 #include <cstdio>
+#include <memory>
 #include <mutex>
 #include <thread>
 #include <unordered_map>
@@ -39,6 +50,7 @@ struct msgbuf {
 
     void reserve(size_t bytes);
     void *consume_message(size_t *length);
+    bool is_empty() const { return pos == len; }
 };
 
 }
@@ -51,10 +63,24 @@ class repclient_protocol {
 public:
     using stream_id = uint64_t;
 
+    repclient_protocol();
+    // receive_buffer_size must be a power of two. Messages larger than it are still
+    // received, but are copied out of the buffer.
+    explicit repclient_protocol(size_t receive_buffer_size);
+
     aether::container::ring_buffer<char>& get_send_buffer();
-    aether::container::ring_buffer<char>& get_receive_buffer();
+    aether::container::spsc_ring_buffer<char>& get_receive_buffer();
 
     void *tick(stream_id *, uint64_t *msg_size);
+    // True if reads since the last call took the receive buffer out of the full
+    // state, so the receiving thread may need waking
+    bool consume_receive_unblocked();
+    // Called by the receiving thread just before it adds bytes_read bytes to the receive
+    // buffer, with the time in seconds at which they were read
+    void stamp_receive(size_t bytes_read, double time);
+    // The time of the read that completed the bytes parsed so far, which include the
+    // last message returned by tick(). False if that read was not stamped.
+    bool get_arrival_time(double &time);
     bool try_send(const void *data, size_t length);
     bool try_send_authentication_payload(const void *data, size_t length);
     bool try_authenticate_player_id(uint64_t id);
@@ -62,9 +88,16 @@ public:
 
 private:
     using msgbuf = aether::repclient::detail::msgbuf;
-    static constexpr size_t SEND_BUFFER_SIZE = 4 * 1024;
+    // The send buffer starts at SEND_BUFFER_SIZE and grows to MAX_SEND_BUFFER_SIZE
+    // while the connection is not keeping up
+    static constexpr size_t SEND_BUFFER_SIZE = 64 * 1024;
+    static constexpr size_t MAX_SEND_BUFFER_SIZE = 4 * 1024 * 1024;
     static constexpr size_t RECEIVE_BUFFER_SIZE = 512 * 1024;
+    static constexpr size_t RELEASE_BATCHES = 8;
+    static constexpr size_t ARRIVAL_STAMPS = 4096;
     size_t try_fill_buf_simulation(void *buf, size_t wanted);
+    size_t fill_msgbuf(msgbuf &buf, size_t wanted);
+    void release_consumed();
 
     HADEAN_PACK(struct multiplexer_header {
         stream_id id;
@@ -72,9 +105,28 @@ private:
     }) cur_header = {0, 0};
 
     bool try_send_message(aether::message_encoding::client::message_type ty, const void *data, size_t len);
-    size_t cur_header_got = 0;
+    bool have_header = false;
+    // Bytes at the front of the receive buffer that have been parsed but not yet
+    // released to the receiving thread. Releases are batched since each one is a
+    // full memory fence.
+    size_t consumed = 0;
+    bool receive_unblocked = false;
     std::unordered_map<stream_id, msgbuf> msgbufs;
-    aether::container::ring_buffer<char> receive_buffer{RECEIVE_BUFFER_SIZE};
+    // Filled by the receiving thread and drained by tick() without a lock
+    aether::container::spsc_ring_buffer<char> receive_buffer;
+
+    struct arrival_stamp {
+        // Bytes received on the connection up to the end of the read
+        uint64_t end;
+        double time;
+    };
+    // Bytes received, written only by the receiving thread
+    uint64_t received = 0;
+    // Bytes released from the receive buffer, written only by tick()
+    uint64_t released = 0;
+    // One stamp per read, filled by the receiving thread. A read made while this is full
+    // is not stamped, so its bytes take the time of the next stamped read.
+    aether::container::spsc_ring_buffer<arrival_stamp> arrival_stamps{ARRIVAL_STAMPS};
     aether::container::ring_buffer<char> send_buffer{SEND_BUFFER_SIZE};
 };
 
@@ -83,47 +135,122 @@ public:
     using stream_id = repclient_protocol::stream_id;
     using duration_type = std::chrono::duration<double>;
 
+    enum class send_result {
+        QUEUED,
+        // The send buffer is at its size limit
+        QUEUE_FULL,
+        // In PLAYBACK mode, or the connection has failed
+        NOT_CONNECTED,
+    };
+
+    // A message returned by tick_batch(). data is only valid during the callback.
+    struct message_view {
+        stream_id worker_id;
+        const void *data;
+        size_t length;
+        // When the message was read from the connection, as time since the first message
+        // like last_packet_time(). In PLAYBACK mode, the time it was recorded with.
+        duration_type arrival_time;
+    };
+
 private:
     static constexpr int MAX_SHUTDOWN_TIME_SECONDS = 1; // WARNING: 0 -> busy looping on select()
+    // Coalesced messages are sent early once about a packet's worth is queued
+    static constexpr size_t COALESCE_FLUSH_SIZE = 1400;
     static constexpr const char *DEFAULT_DUMP_FILE = "aether_recording.dump";
     enum class mode { LIVE, RECORD, PLAYBACK };
+#if defined(AETHER_REPCLIENT_EPOLL)
+    static void do_event_loop(repclient&);
+#else
     static void do_sends(repclient&);
     static void do_receives(repclient&);
+#endif
     static aether::tcp::os_socket construct_socket(const char *host, const char *port);
 
     mode client_mode;
     aether::tcp::os_socket socket = INVALID_SOCKET;
     repclient_protocol impl;
     std::atomic_bool alive{true};
+    // Cleared when the I/O threads stop because the connection failed
+    std::atomic_bool connected{true};
     size_t doing_send = 0;
+#if defined(AETHER_REPCLIENT_EPOLL)
+    int epoll_fd = -1;
+    int wake_fd = -1;
+    std::thread io_thread;
+#else
     std::thread send_thread;
     std::thread receive_thread;
-    std::mutex send_mutex;
     std::mutex receive_mutex;
-    std::condition_variable send_condition;
     std::condition_variable receive_condition;
-    FILE *rec_file = nullptr;
+#endif
+    std::mutex send_mutex;
+    std::condition_variable send_condition;
+    std::atomic<int64_t> coalesce_window_us{0};
+    // Guarded by send_mutex. When the send buffer last became non-empty, and whether
+    // it holds a message that should not wait for the coalescing window.
+    aether::timer::time_type send_queued_since {};
+    bool send_urgent = false;
+    // Receive times are measured from here, which is set before the I/O threads start
+    aether::timer::time_type connect_time {};
     aether::timer::time_type start_time {};
-    float current_packet_time = 0.0;
-    aether::repclient::detail::msgbuf playback_buf;
+    double current_packet_time = 0.0;
+    std::unique_ptr<aether::repclient::recorder> rec;
+    std::unique_ptr<aether::repclient::playback> player;
 
     void setup_threads();
+    void wake_receiver();
+    void wake_sender();
+    void *next_message(stream_id *id, uint64_t *msg_size);
     void *tick_live(stream_id *id, uint64_t *msg_size);
     void *tick_record(stream_id *id, uint64_t *msg_size);
     void *tick_playback(stream_id *id, uint64_t *msg_size);
-    template<typename F> void do_sending_operation(F &op);
+    template<typename F> send_result do_sending_operation(F &op, bool block, bool urgent);
+    // How much longer queued messages should wait to be coalesced. Requires send_mutex.
+    aether::timer::duration_type send_delay(aether::timer::time_type now);
+    void connection_lost();
 
 public:
     repclient(const char *host, const char *port);
     repclient(const char *host, const char *port, const char *path);
+    repclient(const char *host, const char *port, const char *path, const aether::repclient::recorder_options &options);
     repclient(const char *path);
     repclient(const repclient &) = delete;
     repclient &operator=(const repclient &) = delete;
+    // The returned message is only valid until the next call to tick()
     void *tick(size_t *msg_size);
+
+    // Passes every complete message that is available to callback as a message_view,
+    // then returns how many there were.
+    template<typename F>
+    size_t tick_batch(F &&callback) {
+        size_t count = 0;
+        stream_id worker_id;
+        uint64_t length = 0;
+        while (const void *const data = next_message(&worker_id, &length)) {
+            const message_view view{worker_id, data, static_cast<size_t>(length), last_packet_time()};
+            callback(view);
+            ++count;
+        }
+        return count;
+    }
+    // Queues an interaction message, waiting for space if the send buffer is full
     void send(const void *data, size_t length);
+    // Queues an interaction message without waiting
+    send_result try_send(const void *data, size_t length);
+    // Holds interaction messages for up to window before sending, so that messages
+    // sent in quick succession share a packet. Zero, the default, sends at once.
+    void set_send_coalescing(std::chrono::microseconds window);
     void authenticate_player_id(const uint64_t id);
     void authenticate_player_id_with_token(const uint64_t id, const std::array<unsigned char, 32>& token);
     void send_authentication_payload(const void *data, size_t len);
     duration_type last_packet_time() const;
+    // The time now on the clock used by last_packet_time(). In PLAYBACK mode this is
+    // the position reached in the recording.
+    duration_type current_time() const;
+    // Controls seeking and speed in PLAYBACK mode. nullptr in other modes.
+    aether::repclient::playback *get_playback();
+    // The recorder in RECORD mode, for its drop counters. nullptr in other modes.
+    aether::repclient::recorder *get_recorder();
     ~repclient();
 };
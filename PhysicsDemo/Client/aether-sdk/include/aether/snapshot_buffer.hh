@@ -0,0 +1,105 @@
+#pragma once
+
+#include <aether/common/base_protocol.hh>
+#include <aether/common/vector.hh>
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <unordered_map>
+
+namespace aether {
+
+// Smooths entity motion received at the simulation tick rate. Each entity keeps a short
+// history of timestamped samples, and is drawn at a render time that trails the newest
+// samples by a playout delay, interpolating position linearly and orientation by slerp.
+//
+// Sample times come from packet arrival times (repclient::last_packet_time()), with
+// the jitter taken out using the tick number in each worker's client_message header.
+// The playout delay follows one tick interval plus a multiple of the measured jitter,
+// so a steady connection is drawn with little added latency and a jittery one without
+// stutter. Nothing here depends on rendering, so it can be driven from recorded times.
+//
+// Past the newest sample an entity is extrapolated at that sample's velocity. This
+// covers late packets, and entities the muxer holds back while its dead reckoning
+// (generic_interest_policy::prediction_tolerance) says the client's estimate is good.
+class snapshot_buffer {
+public:
+    struct options {
+        // Bounds on the playout delay in seconds
+        double min_delay = 0.03;
+        double max_delay = 0.5;
+        // Multiple of the jitter estimate added to the tick interval
+        double jitter_multiplier = 3.0;
+        // How fast the playout delay may change, in seconds per second, so that the
+        // render clock never jumps
+        double delay_slew_rate = 0.25;
+        // Samples kept per entity
+        size_t max_samples = 8;
+        // Limit on how far past its newest sample an entity is extrapolated, in
+        // seconds. This should exceed the muxer's prediction keepalive.
+        double max_extrapolation = 2.0;
+    };
+
+    struct state {
+        vec3f position;
+        protocol::base::net_quat orientation;
+        vec3f velocity = vec3f::zero();
+    };
+
+    snapshot_buffer();
+    explicit snapshot_buffer(const options &opts);
+
+    // Returns the time to use for samples from a packet that arrived at arrival_time
+    // from worker_id. A tick of zero means the worker does not report ticks, in which
+    // case packets are counted instead.
+    double on_packet(uint64_t worker_id, uint64_t tick, double arrival_time);
+
+    void add(uint64_t entity_id, double time, const state &sample);
+    void remove(uint64_t entity_id);
+    void remove_worker(uint64_t worker_id);
+    void clear();
+
+    // Moves the render time to now minus the playout delay. now must be on the same
+    // clock as the arrival times.
+    void advance(double now);
+
+    // The interpolated state of an entity at the render time. Returns false if the
+    // entity has no samples.
+    bool sample(uint64_t entity_id, state &out) const;
+
+    double get_render_time() const;
+    double get_playout_delay() const;
+    // Smoothed deviation of packet arrival times from the tick schedule, in seconds
+    double get_jitter() const;
+    // The longest estimated tick interval of any worker, in seconds
+    double get_tick_interval() const;
+
+private:
+    struct timed_state {
+        double time;
+        state value;
+    };
+
+    struct worker_clock {
+        uint64_t last_tick = 0;
+        uint64_t packets = 0;
+        double last_arrival = 0.0;
+        double last_time = 0.0;
+        // Seconds per tick, zero until two packets have arrived
+        double interval = 0.0;
+    };
+
+    options opts;
+    std::unordered_map<uint64_t, std::deque<timed_state>> entities;
+    std::unordered_map<uint64_t, worker_clock> workers;
+    double jitter = 0.0;
+    double playout_delay;
+    double render_time = 0.0;
+    double last_advance = 0.0;
+    bool advanced = false;
+
+    double target_delay() const;
+};
+
+}
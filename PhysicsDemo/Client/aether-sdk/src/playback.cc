@@ -0,0 +1,316 @@
+#include <aether/playback.hh>
+
+#if defined(AETHER_WITH_ZSTD)
+#include <aether/common/io/in_memory.hh>
+#include <aether/common/io/zstd.hh>
+#endif
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__linux__)
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#elif defined(_WIN32)
+
+// Silence warnings about fopen
+#define _CRT_SECURE_NO_WARNINGS
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+
+#include <windows.h>
+
+#endif
+
+namespace aether {
+
+namespace repclient {
+
+static constexpr uint32_t ZSTD_FRAME_MAGIC = 0xFD2FB528;
+static constexpr size_t DECOMPRESS_CHUNK_SIZE = 1 << 20;
+
+template<typename T>
+static T read_value(const uint8_t *const data) {
+    T value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+playback::playback(const char *const _path) : path(_path) {
+    map_file();
+    load_index();
+    const size_t indexed = index.size();
+    build_index();
+    if (index.size() != indexed) {
+        save_index();
+    }
+}
+
+playback::~playback() {
+    unmap_file();
+}
+
+void playback::map_file() {
+#if defined(__linux__)
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        perror("open");
+        abort();
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        perror("fstat");
+        abort();
+    }
+    file_size = static_cast<size_t>(st.st_size);
+    if (file_size > 0) {
+        // Copy-on-write, so callers can modify messages in place as they can live ones
+        void *const addr = mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (addr != MAP_FAILED) {
+            madvise(addr, file_size, MADV_SEQUENTIAL);
+            file_data = static_cast<uint8_t*>(addr);
+            mapped = true;
+        }
+    }
+    close(fd);
+#elif defined(_WIN32)
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "Unable to open recording %s\n", path.c_str());
+        abort();
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        fprintf(stderr, "Unable to get size of recording %s\n", path.c_str());
+        abort();
+    }
+    file_size = static_cast<size_t>(size.QuadPart);
+    HANDLE mapping = file_size > 0 ? CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr) : nullptr;
+    if (mapping != nullptr) {
+        void *const addr = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+        if (addr != nullptr) {
+            file_data = static_cast<uint8_t*>(addr);
+            mapped = true;
+            file_handle = file;
+            mapping_handle = mapping;
+        } else {
+            CloseHandle(mapping);
+        }
+    }
+    if (!mapped) {
+        CloseHandle(file);
+    }
+#endif
+
+    if (!mapped && file_size > 0) {
+        // Fall back to reading the whole recording into memory
+        FILE *const file = fopen(path.c_str(), "rb");
+        if (file == nullptr) {
+            perror("fopen");
+            abort();
+        }
+        file_copy.resize(file_size);
+        file_size = fread(file_copy.data(), sizeof(uint8_t), file_copy.size(), file);
+        fclose(file);
+        file_data = file_copy.data();
+    }
+
+    if (file_size >= sizeof(ZSTD_FRAME_MAGIC) && read_value<uint32_t>(file_data) == ZSTD_FRAME_MAGIC) {
+        decompress_file();
+    }
+}
+
+void playback::decompress_file() {
+#if defined(AETHER_WITH_ZSTD)
+    std::vector<uint8_t> decompressed;
+    {
+        in_memory_reader compressed(file_data, file_size);
+        zstd_reader<in_memory_reader> reader(compressed);
+        while (true) {
+            const size_t old_size = decompressed.size();
+            decompressed.resize(old_size + DECOMPRESS_CHUNK_SIZE);
+            const ssize_t n = reader.read(&decompressed[old_size], DECOMPRESS_CHUNK_SIZE);
+            decompressed.resize(old_size + std::max<ssize_t>(n, 0));
+            if (n < 0) {
+                // Keep what could be decompressed, as for a truncated recording
+                fprintf(stderr, "Error decompressing recording %s\n", path.c_str());
+                break;
+            }
+            if (n == 0) { break; }
+        }
+    }
+    unmap_file();
+    file_copy = std::move(decompressed);
+    file_data = file_copy.data();
+    file_size = file_copy.size();
+#else
+    fprintf(stderr, "%s is compressed, but zstd support was not built (AETHER_WITH_ZSTD)\n", path.c_str());
+    abort();
+#endif
+}
+
+void playback::unmap_file() {
+    if (!mapped) { return; }
+#if defined(__linux__)
+    munmap(file_data, file_size);
+#elif defined(_WIN32)
+    UnmapViewOfFile(file_data);
+    CloseHandle(static_cast<HANDLE>(mapping_handle));
+    CloseHandle(static_cast<HANDLE>(file_handle));
+#endif
+    file_data = nullptr;
+    mapped = false;
+}
+
+std::string playback::get_index_path(const std::string &recording_path) {
+    return recording_path + ".idx";
+}
+
+// The recorder appends to the index as it goes, so a partial final entry is ignored.
+// Entries are trusted if their offsets increase and the last one matches a record in
+// the recording.
+void playback::load_index() {
+    index.clear();
+    FILE *const file = fopen(get_index_path(path).c_str(), "rb");
+    if (file == nullptr) { return; }
+
+    uint64_t magic;
+    bool ok = fread(&magic, sizeof(magic), 1, file) == 1 && magic == INDEX_MAGIC;
+    while (ok) {
+        index_entry entry;
+        if (fread(&entry.offset, sizeof(entry.offset), 1, file) != 1
+            || fread(&entry.time, sizeof(entry.time), 1, file) != 1) {
+            break;
+        }
+        ok = index.empty() || entry.offset > index.back().offset;
+        index.push_back(entry);
+    }
+    fclose(file);
+
+    if (ok && !index.empty()) {
+        const auto &last = index.back();
+        ok = last.offset <= file_size && file_size - last.offset >= RECORD_HEADER_SIZE;
+        if (ok) {
+            const uint8_t *const record = file_data + last.offset;
+            const auto length = read_value<uint64_t>(record + sizeof(uint64_t) + sizeof(float));
+            ok = read_value<float>(record + sizeof(uint64_t)) == last.time
+                && length <= file_size - last.offset - RECORD_HEADER_SIZE;
+        }
+    }
+    if (!ok) {
+        fprintf(stderr, "Ignoring stale playback index %s\n", get_index_path(path).c_str());
+        index.clear();
+    }
+}
+
+// Indexes the records after those already in the index
+void playback::build_index() {
+    size_t offset = 0;
+    if (!index.empty()) {
+        const uint8_t *const last = file_data + index.back().offset;
+        offset = index.back().offset + RECORD_HEADER_SIZE
+            + read_value<uint64_t>(last + sizeof(uint64_t) + sizeof(float));
+    }
+    while (file_size - offset >= RECORD_HEADER_SIZE) {
+        const uint8_t *const record = file_data + offset;
+        const auto time = read_value<float>(record + sizeof(uint64_t));
+        const auto length = read_value<uint64_t>(record + sizeof(uint64_t) + sizeof(float));
+        if (length > file_size - offset - RECORD_HEADER_SIZE) {
+            // Truncated record
+            break;
+        }
+        index.push_back(index_entry{offset, time});
+        offset += RECORD_HEADER_SIZE + length;
+    }
+}
+
+void playback::save_index() const {
+    // The index is only a cache, so failing to write it is not an error
+    FILE *const file = fopen(get_index_path(path).c_str(), "wb");
+    if (file == nullptr) { return; }
+    bool ok = fwrite(&INDEX_MAGIC, sizeof(INDEX_MAGIC), 1, file) == 1;
+    for (const auto &entry : index) {
+        if (!ok) { break; }
+        ok &= fwrite(&entry.offset, sizeof(entry.offset), 1, file) == 1;
+        ok &= fwrite(&entry.time, sizeof(entry.time), 1, file) == 1;
+    }
+    ok &= fclose(file) == 0;
+    if (!ok) {
+        remove(get_index_path(path).c_str());
+    }
+}
+
+void playback::restart_clock(const double recording_time) {
+    base_time = recording_time;
+    clock_start = timer::get();
+}
+
+void *playback::next(uint64_t *const worker_id, uint64_t *const length, float *const time) {
+    if (at_end()) { return nullptr; }
+    const auto &entry = index[cursor];
+    if (speed != UNTHROTTLED) {
+        if (clock_start == timer::time_type{}) { restart_clock(base_time); }
+        if (position() < entry.time) { return nullptr; }
+    }
+    uint8_t *const record = file_data + entry.offset;
+    *worker_id = read_value<uint64_t>(record);
+    *time = entry.time;
+    *length = read_value<uint64_t>(record + sizeof(uint64_t) + sizeof(float));
+    ++cursor;
+    return record + RECORD_HEADER_SIZE;
+}
+
+void playback::seek(const double seconds) {
+    const auto it = std::lower_bound(index.begin(), index.end(), seconds,
+        [](const index_entry &entry, const double t) { return entry.time < t; });
+    cursor = static_cast<size_t>(it - index.begin());
+    restart_clock(seconds);
+}
+
+void playback::set_speed(const double multiplier) {
+    assert(multiplier > 0.0 && "Playback speed must be positive");
+    const double now = position();
+    speed = multiplier;
+    restart_clock(now);
+}
+
+double playback::get_speed() const {
+    return speed;
+}
+
+double playback::position() const {
+    if (speed == UNTHROTTLED || clock_start == timer::time_type{}) {
+        return at_end() ? duration() : std::max<double>(base_time, cursor > 0 ? index[cursor - 1].time : 0.0);
+    }
+    return base_time + timer::diff(timer::get(), clock_start) * speed;
+}
+
+double playback::duration() const {
+    return index.empty() ? 0.0 : index.back().time;
+}
+
+size_t playback::size() const {
+    return index.size();
+}
+
+bool playback::at_end() const {
+    return cursor >= index.size();
+}
+
+span<const playback::index_entry> playback::get_index() const {
+    return span<const index_entry>(index.data(), index.size());
+}
+
+}
+
+}
@@ -0,0 +1,202 @@
+#if defined(_WIN32)
+// Silence warnings about fopen
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <aether/recorder.hh>
+#include <aether/common/io/io.hh>
+
+#if defined(AETHER_WITH_ZSTD)
+#include <aether/common/io/zstd.hh>
+#endif
+
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+
+namespace aether {
+
+namespace repclient {
+
+namespace {
+
+struct file_writer final : public aether::writer {
+    FILE *file;
+
+    explicit file_writer(FILE *const f) : file(f) {}
+
+    ssize_t write(const void *const data, const size_t count) final {
+        const size_t n = fwrite(data, sizeof(char), count, file);
+        return n == count ? static_cast<ssize_t>(n) : -1;
+    }
+
+    int flush() final {
+        return fflush(file) == 0 ? 0 : -1;
+    }
+};
+
+FILE *open_for_writing(const std::string &path) {
+    FILE *const file = fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        perror("fopen");
+        abort();
+    }
+    return file;
+}
+
+void close_file(FILE *const file) {
+    if (fclose(file) != 0) {
+        perror("fclose");
+        abort();
+    }
+}
+
+template<typename T>
+void append_value(std::vector<uint8_t> &data, const T &value) {
+    const size_t old_size = data.size();
+    data.resize(old_size + sizeof(value));
+    memcpy(&data[old_size], &value, sizeof(value));
+}
+
+}
+
+recorder::recorder(const char *const path, const recorder_options &_options) : options(_options) {
+#if !defined(AETHER_WITH_ZSTD)
+    if (options.compress) {
+        fprintf(stderr, "Recording uncompressed, zstd support was not built (AETHER_WITH_ZSTD)\n");
+        options.compress = false;
+    }
+#endif
+    file = open_for_writing(path);
+    index_file = open_for_writing(playback::get_index_path(path));
+    if (fwrite(&playback::INDEX_MAGIC, sizeof(playback::INDEX_MAGIC), 1, index_file) != 1) {
+        perror("fwrite");
+        abort();
+    }
+
+    current = std::make_unique<block>();
+    current->data.reserve(options.block_size);
+    writer_thread = std::thread(do_writes, std::ref(*this));
+}
+
+recorder::~recorder() {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!current->data.empty()) {
+            queued.push_back(std::move(current));
+        }
+        closing = true;
+    }
+    condition.notify_all();
+    writer_thread.join();
+    close_file(file);
+    close_file(index_file);
+}
+
+bool recorder::append(const uint64_t worker_id, const float time, const void *const data, const uint64_t length) {
+    const size_t record_size = playback::RECORD_HEADER_SIZE + length;
+    if (!current->data.empty() && current->data.size() + record_size > options.block_size && !submit()) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    auto &out = current->data;
+    current->index.push_back(playback::index_entry{offset, time});
+    append_value(out, worker_id);
+    append_value(out, time);
+    append_value(out, length);
+    const size_t old_size = out.size();
+    out.resize(old_size + length);
+    if (length > 0) {
+        memcpy(&out[old_size], data, length);
+    }
+    offset += record_size;
+    return true;
+}
+
+bool recorder::submit() {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (queued.size() >= options.max_queued_blocks) {
+            return false;
+        }
+        queued.push_back(std::move(current));
+        if (!spare.empty()) {
+            current = std::move(spare.back());
+            spare.pop_back();
+        }
+    }
+    condition.notify_one();
+    if (current == nullptr) {
+        current = std::make_unique<block>();
+        current->data.reserve(options.block_size);
+    }
+    return true;
+}
+
+void recorder::do_writes(recorder &r) {
+    file_writer data_out(r.file);
+    file_writer index_out(r.index_file);
+#if defined(AETHER_WITH_ZSTD)
+    std::unique_ptr<zstd_writer<file_writer>> compressed;
+    if (r.options.compress) {
+        compressed = std::make_unique<zstd_writer<file_writer>>(data_out);
+    }
+    aether::writer &out = compressed ? static_cast<aether::writer&>(*compressed) : data_out;
+#else
+    aether::writer &out = data_out;
+#endif
+
+    while (true) {
+        std::unique_ptr<block> next;
+        {
+            std::unique_lock<std::mutex> lock(r.mutex);
+            r.condition.wait(lock, [&r] { return !r.queued.empty() || r.closing; });
+            if (r.queued.empty()) { break; }
+            next = std::move(r.queued.front());
+            r.queued.pop_front();
+        }
+
+        // The data goes out before the index entries that point into it
+        bool ok = write_all(out, next->data.data(), next->data.size()) == 0 && out.flush() == 0;
+        if (ok && &out != &data_out) {
+            ok = data_out.flush() == 0;
+        }
+        for (const auto &entry : next->index) {
+            ok = ok && write_all(index_out, &entry.offset, sizeof(entry.offset)) == 0
+                && write_all(index_out, &entry.time, sizeof(entry.time)) == 0;
+        }
+        ok = ok && index_out.flush() == 0;
+        if (!ok) {
+            perror("Unable to write recording");
+            abort();
+        }
+        r.written.fetch_add(next->index.size(), std::memory_order_relaxed);
+
+        next->data.clear();
+        next->index.clear();
+        std::unique_lock<std::mutex> lock(r.mutex);
+        r.spare.push_back(std::move(next));
+    }
+
+#if defined(AETHER_WITH_ZSTD)
+    // Ends the frame
+    compressed.reset();
+#endif
+    if (data_out.flush() != 0) {
+        perror("fflush");
+        abort();
+    }
+}
+
+uint64_t recorder::get_dropped() const {
+    return dropped.load(std::memory_order_relaxed);
+}
+
+uint64_t recorder::get_written() const {
+    return written.load(std::memory_order_relaxed);
+}
+
+}
+
+}
@@ -27,6 +27,12 @@
 #include <sys/socket.h>
 #include <sys/stat.h>
 
+#if defined(AETHER_REPCLIENT_EPOLL)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#endif
+
 #elif defined(_WIN32)
 
 // Silence warnings about fopen
@@ -41,7 +47,6 @@ namespace tcp = aether::tcp;
 namespace timer = aether::timer;
 namespace client_encoding = aether::message_encoding::client;
 
-static constexpr size_t MIN_SLACK_BYTES = 128;
 static constexpr size_t MIN_BUF_SIZE = 1024;
 
 namespace aether {
@@ -60,11 +65,18 @@ void *msgbuf::consume_message(size_t *const length) {
     using prefix_t = uint32_t;
     const size_t remaining = len - pos;
     if (remaining < sizeof(prefix_t)) { return nullptr; }
-    const prefix_t message_size = *(reinterpret_cast<const prefix_t*>(&buf[pos]));
+    prefix_t message_size;
+    memcpy(&message_size, &buf[pos], sizeof(message_size));
     if (remaining < sizeof(prefix_t) + message_size) { return nullptr; }
     *length = message_size;
     const auto old_pos = pos;
     pos += sizeof(prefix_t) + message_size;
+    // Once drained, the next fill starts at the front again and does not need to
+    // move anything. The message stays valid until then.
+    if (pos == len) {
+        pos = 0;
+        len = 0;
+    }
     return &buf[old_pos + sizeof(prefix_t)];
 }
 
@@ -74,15 +86,140 @@ void *msgbuf::consume_message(size_t *const length) {
 
 }
 
-static void close_file(FILE *const f) {
-    assert(f != nullptr);
-    const auto ret = fclose(f);
-    if (ret != 0) {
-        perror("fclose");
-        abort();
+// Sends from both halves of the send buffer with one call
+static ssize_t send_queued(const tcp::os_socket socket, const aether::container::ring_buffer<char> &send_buffer) {
+    const auto first = send_buffer.get_head();
+    const auto second = send_buffer.get_from_offset(first.size());
+#if defined(_WIN32)
+    std::array<WSABUF, 2> bufs;
+    bufs[0].len = static_cast<ULONG>(first.size());
+    bufs[0].buf = const_cast<CHAR*>(first.data());
+    bufs[1].len = static_cast<ULONG>(second.size());
+    bufs[1].buf = const_cast<CHAR*>(second.data());
+    DWORD bytes_written = 0;
+    if (WSASend(socket, bufs.data(), second.empty() ? 1 : 2, &bytes_written, 0, nullptr, nullptr) != 0) {
+        return -1;
+    }
+    return static_cast<ssize_t>(bytes_written);
+#else
+    std::array<iovec, 2> iov;
+    iov[0].iov_base = const_cast<char*>(first.data());
+    iov[0].iov_len = first.size();
+    iov[1].iov_base = const_cast<char*>(second.data());
+    iov[1].iov_len = second.size();
+    msghdr msg{};
+    msg.msg_iov = iov.data();
+    msg.msg_iovlen = second.empty() ? 1 : 2;
+    return sendmsg(socket, &msg, MSG_NOSIGNAL);
+#endif
+}
+
+#if defined(AETHER_REPCLIENT_EPOLL)
+
+// Services the socket from a single thread. The socket is registered edge-triggered,
+// so after each notification it is read and written until the kernel reports
+// EAGAIN. The eventfd wakes the loop when send() enqueues data, when tick() frees
+// space in a full receive buffer, and on shutdown. While messages are held back for
+// coalescing, the wait times out when they are due.
+void repclient::do_event_loop(repclient &client) {
+    auto &receive_buffer = client.impl.get_receive_buffer();
+    auto &send_buffer = client.impl.get_send_buffer();
+    // Until the kernel says otherwise, assume the socket can be read and written
+    bool readable = true;
+    bool writable = true;
+    bool alive = true;
+    std::array<epoll_event, 2> events;
+    while (alive) {
+        alive &= client.alive;
+        int timeout_ms = -1;
+
+        if (readable) {
+            while (receive_buffer.has_space()) {
+                // Fill both free regions of the ring with one call
+                const auto regions = receive_buffer.get_unallocated_regions();
+                std::array<iovec, 2> iov;
+                for (size_t i = 0; i < iov.size(); ++i) {
+                    iov[i].iov_base = regions[i].data();
+                    iov[i].iov_len = regions[i].size();
+                }
+                const ssize_t bytes_read = readv(client.socket, iov.data(), regions[1].empty() ? 1 : 2);
+                if (bytes_read > 0) {
+                    client.impl.stamp_receive(bytes_read, timer::diff(timer::get(), client.connect_time));
+                    receive_buffer.move_tail(bytes_read);
+                } else if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    readable = false;
+                    break;
+                } else if (bytes_read < 0 && errno == EINTR) {
+                    continue;
+                } else if (bytes_read == 0) {
+                    alive = false;
+                    AETHER_LOG(ERROR)("Connection closed, killing event loop.");
+                    break;
+                } else {
+                    alive = false;
+                    AETHER_LOG(ERROR)("Error receiving, killing event loop.");
+                    break;
+                }
+            }
+        }
+
+        bool notify_senders = false;
+        if (writable) {
+            std::unique_lock<std::mutex> lock(client.send_mutex);
+            const bool doing_send = client.doing_send > 0;
+            size_t total_written = 0;
+            const auto delay = client.send_delay(timer::get());
+            if (alive && delay > timer::duration_type::zero()) {
+                const auto delay_ms = std::chrono::ceil<std::chrono::milliseconds>(delay);
+                timeout_ms = static_cast<int>(delay_ms.count());
+            }
+            while (timeout_ms < 0 && !send_buffer.is_empty()) {
+                const ssize_t bytes_written = send_queued(client.socket, send_buffer);
+                if (bytes_written >= 0) {
+                    send_buffer.move_head(bytes_written);
+                    client.send_urgent &= !send_buffer.is_empty();
+                    total_written += bytes_written;
+                } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    writable = false;
+                    break;
+                } else if (errno == EINTR) {
+                    continue;
+                } else {
+                    alive = false;
+                    AETHER_LOG(ERROR)("Error sending, killing event loop.");
+                    break;
+                }
+            }
+            notify_senders = doing_send && total_written > 0;
+        }
+        if (notify_senders) {
+            client.send_condition.notify_all();
+        }
+
+        if (!alive) { break; }
+        const int num_events = epoll_wait(client.epoll_fd, events.data(), events.size(), timeout_ms);
+        if (num_events < 0) {
+            if (errno == EINTR) { continue; }
+            AETHER_LOG(ERROR)("Error waiting for events, killing event loop.");
+            break;
+        }
+        for (int i = 0; i < num_events; ++i) {
+            if (events[i].data.fd == client.wake_fd) {
+                uint64_t count;
+                const auto ret = read(client.wake_fd, &count, sizeof(count));
+                (void) ret;
+            } else {
+                // Errors and hangups are reported by the next recv() or send()
+                readable |= (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) != 0;
+                writable |= (events[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) != 0;
+            }
+        }
     }
+    client.connection_lost();
 }
 
+#else
+
 void repclient::do_receives(repclient &client) {
     auto &receive_buffer = client.impl.get_receive_buffer();
     fd_set set;
@@ -113,7 +250,6 @@ void repclient::do_receives(repclient &client) {
             AETHER_LOG(ERROR)("Error receiving, killing receive thread.");
         }
         if (FD_ISSET(client.socket, &set)) {
-            std::unique_lock<std::mutex> lock(client.receive_mutex);
             const auto unallocated = receive_buffer.get_unallocated();
             const ssize_t bytes_read = recv(client.socket,
                 unallocated.data(),
@@ -122,11 +258,13 @@ void repclient::do_receives(repclient &client) {
             if (bytes_read < 0) {
                 alive = false;
                 AETHER_LOG(ERROR)("Error receiving, killing receive thread.");
-            } else {
+            } else if (bytes_read > 0) {
+                client.impl.stamp_receive(bytes_read, timer::diff(timer::get(), client.connect_time));
                 receive_buffer.move_tail(bytes_read);
             }
         }
     }
+    client.connection_lost();
 }
 
 void repclient::do_sends(repclient &client) {
@@ -143,9 +281,15 @@ void repclient::do_sends(repclient &client) {
     while(alive) {
         {
             std::unique_lock<std::mutex> lock(client.send_mutex);
-            client.send_condition.wait(lock, [&client, &send_buffer] {
-                return !send_buffer.is_empty() || !client.alive;
-            });
+            while (client.alive) {
+                if (send_buffer.is_empty()) {
+                    client.send_condition.wait(lock);
+                    continue;
+                }
+                const auto delay = client.send_delay(timer::get());
+                if (delay <= timer::duration_type::zero()) { break; }
+                client.send_condition.wait_for(lock, delay);
+            }
             alive &= client.alive;
         }
         FD_SET(client.socket, &set);
@@ -163,14 +307,12 @@ void repclient::do_sends(repclient &client) {
         if (FD_ISSET(client.socket, &set)) {
             std::unique_lock<std::mutex> lock(client.send_mutex);
             doing_send = client.doing_send > 0;
-            const auto head = send_buffer.get_head();
-            bytes_written = sendto(client.socket,
-                head.data(),
-                head.size(),
-                0,
-                nullptr, 0);
+            if (!send_buffer.is_empty()) {
+                bytes_written = send_queued(client.socket, send_buffer);
+            }
             if (bytes_written > 0) {
                 send_buffer.move_head(bytes_written);
+                client.send_urgent &= !send_buffer.is_empty();
             }
         }
         if (bytes_written < 0) {
@@ -180,6 +322,26 @@ void repclient::do_sends(repclient &client) {
             client.send_condition.notify_all();
         }
     }
+    client.connection_lost();
+}
+
+#endif
+
+size_t repclient_protocol::fill_msgbuf(msgbuf &buf, const size_t wanted) {
+    // Copies start at the head of the receive buffer
+    release_consumed();
+    if (wanted == 0) { return 0; }
+    // shift the buf back to the beginning since we're going to be receiving network data
+    if (buf.pos > 0) {
+        memmove(&buf.buf[0], &buf.buf[buf.pos], buf.len - buf.pos);
+        buf.len -= buf.pos;
+        buf.pos = 0;
+    }
+    // wanted is bounded by what is already in the receive buffer, so make room for all of it
+    buf.reserve(buf.len + wanted);
+    const size_t n = try_fill_buf_simulation(&buf.buf[buf.len], std::min(wanted, buf.buf.size() - buf.len));
+    buf.len += n;
+    return n;
 }
 
 size_t repclient_protocol::try_fill_buf_simulation(void *const buf, const size_t wanted) {
@@ -187,8 +349,9 @@ size_t repclient_protocol::try_fill_buf_simulation(void *const buf, const size_t
     {
         bool progress = true;
         while (progress && copied < wanted) {
-            const size_t copy_size = receive_buffer.try_read(static_cast<char*>(buf) + copied, wanted - copied);
+            const size_t copy_size = receive_buffer.try_read(static_cast<char*>(buf) + copied, wanted - copied, receive_unblocked);
             copied += copy_size;
+            released += copy_size;
             progress = copy_size > 0;
         }
     }
@@ -199,14 +362,68 @@ typename repclient::duration_type repclient::last_packet_time() const {
     return std::chrono::duration<double>(current_packet_time);
 }
 
+typename repclient::duration_type repclient::current_time() const {
+    if (client_mode == mode::PLAYBACK) {
+        return duration_type(player->position());
+    }
+    if (start_time == timer::time_type{}) {
+        return duration_type::zero();
+    }
+    return duration_type(timer::diff(timer::get(), start_time));
+}
+
+aether::repclient::playback *repclient::get_playback() {
+    return player.get();
+}
+
+aether::repclient::recorder *repclient::get_recorder() {
+    return rec.get();
+}
+
+repclient_protocol::repclient_protocol() : repclient_protocol(RECEIVE_BUFFER_SIZE) {
+}
+
+repclient_protocol::repclient_protocol(const size_t receive_buffer_size) : receive_buffer(receive_buffer_size) {
+}
+
 aether::container::ring_buffer<char> &repclient_protocol::get_send_buffer() {
     return send_buffer;
 }
 
-aether::container::ring_buffer<char> &repclient_protocol::get_receive_buffer() {
+aether::container::spsc_ring_buffer<char> &repclient_protocol::get_receive_buffer() {
     return receive_buffer;
 }
 
+bool repclient_protocol::consume_receive_unblocked() {
+    const bool result = receive_unblocked;
+    receive_unblocked = false;
+    return result;
+}
+
+void repclient_protocol::stamp_receive(const size_t bytes_read, const double time) {
+    received += bytes_read;
+    const arrival_stamp stamp{received, time};
+    arrival_stamps.try_write(&stamp, 1);
+}
+
+bool repclient_protocol::get_arrival_time(double &time) {
+    const uint64_t position = released + consumed;
+    // Stamps of reads that end before the parsed bytes are no longer needed
+    size_t stale = 0;
+    arrival_stamp stamp;
+    bool found = false;
+    while (arrival_stamps.peek(&stamp, stale, 1)) {
+        if (stamp.end >= position) {
+            time = stamp.time;
+            found = true;
+            break;
+        }
+        ++stale;
+    }
+    arrival_stamps.move_head(stale);
+    return found;
+}
+
 bool repclient_protocol::try_send(const void *const data, const size_t length) {
     return try_send_message(client_encoding::INTERACTION, data, length);
 }
@@ -235,172 +452,149 @@ bool repclient_protocol::try_send_message(client_encoding::message_type ty, cons
     assert(header.payload_size == length && "Interaction message too large");
     constexpr size_t header_size = sizeof(header);
 
-    if (header_size + length <= send_buffer.free()) {
-        send_buffer.extend(
-            static_cast<const char*>(static_cast<const void*>(&header)),
-            header_size);
-        send_buffer.extend(static_cast<const char*>(data), length);
-        return true;
-    } else if (header_size + length <= send_buffer.capacity()) {
-        return false;
-    } else {
+    if (header_size + length > MAX_SEND_BUFFER_SIZE) {
         fprintf(stderr, "Attempted to send interaction packet larger than buffer");
         abort();
     }
-}
-
-
-// Supports both file fds and socket fds, both blocking and nonblocking
-static size_t _internal_try_fill_buf(FILE *const file, void *const buf, const size_t wanted) {
-    if (wanted == 0) { return 0; }
-    const size_t n = fread(buf, sizeof(char), wanted, file);
-    if (n == wanted || feof(file)) {
-        return n;
-    } else {
-#if defined(__linux__)
-        if (errno == EAGAIN || errno == EWOULDBLOCK) {
-            clearerr(file);
-            return 0;
-        }
-#endif
-        perror("fread");
-        abort();
+    const size_t needed = send_buffer.size() + header_size + length;
+    if (needed > MAX_SEND_BUFFER_SIZE) {
+        return false;
     }
+    if (needed > send_buffer.capacity()) {
+        send_buffer.reserve(std::min(MAX_SEND_BUFFER_SIZE, std::max(needed, 2 * send_buffer.capacity())));
+    }
+    send_buffer.extend(
+        static_cast<const char*>(static_cast<const void*>(&header)),
+        header_size);
+    send_buffer.extend(static_cast<const char*>(data), length);
+    return true;
 }
 
-static size_t try_fill_buf_file(FILE *const file, void *const buf, const size_t wanted) {
-    return _internal_try_fill_buf(file, buf, wanted);
-}
-
-static void write_all(FILE *const file, const void *const data, const size_t size) {
-    const size_t n = fwrite(data, sizeof(char), size, file);
-    if (n != size) {
-        perror("fwrite");
-        abort();
+void *repclient::next_message(stream_id *const worker_id, uint64_t *const length) {
+    switch (client_mode) {
+        case mode::LIVE:
+            return tick_live(worker_id, length);
+        case mode::RECORD:
+            return tick_record(worker_id, length);
+        case mode::PLAYBACK:
+            return tick_playback(worker_id, length);
+        default:
+            abort();
     }
 }
 
 void *repclient::tick(size_t *const length) {
-    void *result = nullptr;
     // We want length to be a size_t but we use uint64_t lengths for the
     // helper functions since they use the length parameter to infer the
     // size of the length value in the header.
     stream_id worker_id;
     uint64_t length_u64 = 0;
-    switch (client_mode) {
-        case mode::LIVE:
-            result = tick_live(&worker_id, &length_u64);
-            break;
-        case mode::RECORD:
-            result = tick_record(&worker_id, &length_u64);
-            break;
-        case mode::PLAYBACK:
-            result = tick_playback(&worker_id, &length_u64);
-            break;
-        default:
-            abort();
-    }
+    void *const result = next_message(&worker_id, &length_u64);
     *length = static_cast<size_t>(length_u64);
     assert(*length == length_u64 && "Packet too large");
     return result;
 }
 
 void *repclient::tick_record(uint64_t *const worker_id, uint64_t *const length) {
-    assert(rec_file != nullptr);
+    assert(rec != nullptr);
     if (auto *const buf = static_cast<char *>(tick_live(worker_id, length))) {
-        write_all(rec_file, worker_id, sizeof(*worker_id));
-        write_all(rec_file, &current_packet_time, sizeof(current_packet_time));
-        write_all(rec_file, length, sizeof(*length));
-        write_all(rec_file, buf, *length);
-        const auto ret = fflush(rec_file);
-        if (ret != 0) {
-            perror("fflush");
-            abort();
-        };
+        // A record dropped because the disk is not keeping up is counted by the recorder
+        rec->append(*worker_id, current_packet_time, buf, *length);
         return buf;
     }
     return nullptr;
 }
 
 void *repclient::tick_playback(uint64_t *const worker_id, uint64_t *const length) {
-    // Note that the playback file could be truncated at any point, and we'd really like
-    // to just return NULLs once we reach the 'end', even if it's not been correctly closed
-    assert(rec_file != nullptr);
-    const size_t headersize = sizeof(*worker_id) + sizeof(current_packet_time) + sizeof(*length);
-    auto &playbuf = playback_buf;
-    playbuf.reserve(headersize);
-
-    while (playbuf.len < headersize) {
-        const size_t n = try_fill_buf_file(rec_file, &playbuf.buf[playbuf.len], headersize - playbuf.len);
-        playbuf.len += n;
-        if (n == 0) { return nullptr; }
-    }
-    memcpy(worker_id, &playbuf.buf[0], sizeof(*worker_id));
-    memcpy(&current_packet_time, &playbuf.buf[sizeof(*worker_id)], sizeof(current_packet_time));
-    memcpy(length, &playbuf.buf[sizeof(*worker_id) + sizeof(current_packet_time)], sizeof(*length));
-
-    playbuf.reserve(headersize + *length);
-    while (playbuf.len != *length + headersize) {
-        const size_t n = try_fill_buf_file(rec_file, &playbuf.buf[playbuf.len], headersize + *length - playbuf.len);
-        playbuf.len += n;
-        if (n == 0) { return nullptr; }
+    assert(player != nullptr);
+    float time = 0.0f;
+    void *const packet = player->next(worker_id, length, &time);
+    if (packet != nullptr) {
+        current_packet_time = time;
     }
+    return packet;
+}
 
-    if (start_time == timer::time_type{}) { start_time = timer::get(); }
-    if (timer::diff(timer::get(), start_time) < current_packet_time) {
-        return nullptr;
-    } else {
-        playbuf.len = 0;
-        return &playbuf.buf[headersize];
+void repclient_protocol::release_consumed() {
+    if (consumed > 0) {
+        released += consumed;
+        receive_unblocked |= receive_buffer.move_head(consumed);
+        consumed = 0;
     }
 }
 
-// Although this code exits as soon as a read is too short, it should be asking the OS
-// how many bytes are available and use this
+// Multiplexer headers and message prefixes are parsed in place in the receive buffer.
+// A message that lies contiguously in the buffer within a single multiplexer frame is
+// returned without copying, and its bytes are only released on a later call. Messages
+// that wrap around the end of the buffer or continue into a later frame are assembled
+// in the stream's msgbuf.
 void *repclient_protocol::tick(uint64_t *const worker_id, uint64_t *const length) {
+    using prefix_t = uint32_t;
+    if (consumed >= receive_buffer.capacity() / RELEASE_BATCHES) {
+        release_consumed();
+    }
+
     while (true) {
         // try to recv the multiplexer header
-        if (cur_header_got < sizeof(cur_header)) {
-            const size_t wanted = sizeof(cur_header) - cur_header_got;
-            const size_t n = try_fill_buf_simulation(reinterpret_cast<uint8_t *>(&cur_header) + cur_header_got, wanted);
-            cur_header_got += n;
-            if (cur_header_got != sizeof(cur_header)) {
+        if (!have_header) {
+            if (!receive_buffer.peek(reinterpret_cast<char *>(&cur_header), consumed, sizeof(cur_header))) {
+                release_consumed();
                 return nullptr;
             }
+            consumed += sizeof(cur_header);
+            have_header = true;
         }
 
         // Add new connection if necessary
         const uint64_t wid = cur_header.id;
-
-        // Fill the client buffer
         auto &msgbuf = msgbufs[wid];
-        if (cur_header.len) {
-            // shift the buf back to the beginning since we're going to be receiving network data
-            if (msgbuf.pos > 0) {
-                memmove(&msgbuf.buf[0], &msgbuf.buf[msgbuf.pos], msgbuf.len - msgbuf.pos);
-                msgbuf.len -= msgbuf.pos;
-                msgbuf.pos = 0;
-            }
-            // Initialise buf for first time, or give enough slack to avoid reads of tiny numbers of bytes
-            if (msgbuf.buf.size() - msgbuf.len < MIN_SLACK_BYTES) {
-                msgbuf.reserve(std::max(MIN_BUF_SIZE, msgbuf.buf.size() * 2));
-            }
-            const size_t wanted = std::min(cur_header.len, msgbuf.buf.size() - msgbuf.len);
-            const size_t n = try_fill_buf_simulation(&msgbuf.buf[msgbuf.len], wanted);
-            cur_header.len -= n;
-            msgbuf.len += n;
-        }
 
         // Return a message if present
-        void *const msg = msgbuf.consume_message(length);
-        if (msg != nullptr) {
+        if (void *const msg = msgbuf.consume_message(length)) {
             *worker_id = wid;
             return msg;
-        } else if (cur_header.len > 0) {
-            return nullptr;
-        } else {
+        }
+        if (cur_header.len == 0) {
             // no more messages to drain and no more multiplexer message to recv, prep for next multiplexer header
-            cur_header_got = 0;
+            have_header = false;
+            continue;
+        }
+
+        const size_t available = std::min<uint64_t>(receive_buffer.size() - consumed, cur_header.len);
+        if (msgbuf.is_empty() && cur_header.len >= sizeof(prefix_t)) {
+            const auto run = receive_buffer.get_from_offset(consumed);
+            prefix_t message_size;
+            if (run.size() >= sizeof(prefix_t)) {
+                memcpy(&message_size, run.data(), sizeof(message_size));
+            } else if (!receive_buffer.peek(reinterpret_cast<char *>(&message_size), consumed, sizeof(message_size))) {
+                release_consumed();
+                return nullptr;
+            }
+            const uint64_t total_size = sizeof(prefix_t) + uint64_t{message_size};
+            const bool in_frame = total_size <= cur_header.len;
+            if (in_frame && total_size <= available) {
+                if (run.size() >= total_size) {
+                    cur_header.len -= total_size;
+                    consumed += total_size;
+                    *worker_id = wid;
+                    *length = message_size;
+                    return run.data() + sizeof(prefix_t);
+                }
+                // The message wraps, so copy just this message and leave the rest in place
+                cur_header.len -= fill_msgbuf(msgbuf, total_size);
+                continue;
+            } else if (in_frame && total_size <= receive_buffer.capacity()) {
+                // Wait until the whole message is in the buffer
+                release_consumed();
+                return nullptr;
+            }
+        }
+
+        // The message continues into a later frame, or is larger than the buffer
+        const size_t n = fill_msgbuf(msgbuf, available);
+        cur_header.len -= n;
+        if (n == 0) {
+            return nullptr;
         }
     }
 }
@@ -423,130 +617,204 @@ repclient::repclient(const char *host, const char *port) : client_mode(mode::LIV
 }
 
 repclient::repclient(const char *host, const char *port, const char *path) :
-    client_mode(mode::RECORD) {
-    rec_file = fopen(path ? path : DEFAULT_DUMP_FILE, "wb");
-    if (rec_file == nullptr) {
-        perror("fopen");
-        abort();
-    }
+    repclient(host, port, path, aether::repclient::recorder_options()) {
+}
+
+repclient::repclient(const char *host, const char *port, const char *path,
+    const aether::repclient::recorder_options &options) : client_mode(mode::RECORD),
+    rec(std::make_unique<aether::repclient::recorder>(path ? path : DEFAULT_DUMP_FILE, options)) {
     socket = construct_socket(host, port);
     setup_threads();
 }
 
-repclient::repclient(const char *path) : client_mode(mode::PLAYBACK) {
-    rec_file = fopen(path ? path : DEFAULT_DUMP_FILE, "rb");
-    if (rec_file == nullptr) {
-        perror("fopen");
-        abort();
-    }
-#if defined(__linux__)
-    const auto fd = fileno(rec_file);
-    tcp::socket_set_nonblocking(fd);
-#endif
-    playback_buf.buf.resize(4096);
+repclient::repclient(const char *path) : client_mode(mode::PLAYBACK),
+    player(std::make_unique<aether::repclient::playback>(path ? path : DEFAULT_DUMP_FILE)) {
 }
 
 void *repclient::tick_live(stream_id *worker_id, uint64_t *msg_size) {
-    bool was_full;
-    bool is_full;
-    void *packet;
-    {
-        std::unique_lock<std::mutex> lock(receive_mutex);
-        was_full = impl.get_receive_buffer().is_full();
-        packet = impl.tick(worker_id, msg_size);
-        is_full = impl.get_receive_buffer().is_full();
-    }
-    if (was_full && !is_full) {
-        receive_condition.notify_one();
+    void *const packet = impl.tick(worker_id, msg_size);
+    if (impl.consume_receive_unblocked()) {
+        wake_receiver();
     }
     if (packet != nullptr) {
-        if (start_time == timer::time_type{}) { start_time = timer::get(); }
-        current_packet_time = timer::diff(timer::get(), start_time);
+        // Messages are timed from when the receiving thread read them, rather than now,
+        // which is when the application got round to asking for them
+        double received_time;
+        timer::time_type arrival = timer::get();
+        if (impl.get_arrival_time(received_time)) {
+            arrival = connect_time + std::chrono::duration_cast<timer::duration_type>(std::chrono::duration<double>(received_time));
+        }
+        if (start_time == timer::time_type{}) { start_time = arrival; }
+        current_packet_time = timer::diff(arrival, start_time);
     }
     return packet;
 }
 
 template<typename F>
-void repclient::do_sending_operation(F &operation) {
+repclient::send_result repclient::do_sending_operation(F &operation, const bool block, const bool urgent) {
     if (client_mode != mode::LIVE && client_mode != mode::RECORD) {
-        return;
+        return send_result::NOT_CONNECTED;
     }
 
-    bool was_empty;
-    bool is_empty;
+    bool queued = false;
+    bool wake = false;
     {
         std::unique_lock<std::mutex> lock(send_mutex);
-        was_empty = impl.get_send_buffer().is_empty();
+        auto &send_buffer = impl.get_send_buffer();
+        const size_t old_size = send_buffer.size();
         ++doing_send;
-        bool sent = false;
-        int retry = 5;
-        while (!sent && retry > 0) {
-            send_condition.wait(lock, [this] {
-                return impl.get_send_buffer().has_space();
-            });
-            sent = operation(impl);
-            retry--;
+        // The I/O thread notifies when it has written some of the buffer or has stopped
+        while (connected && !(queued = operation(impl)) && block) {
+            send_condition.wait(lock);
         }
         --doing_send;
-        is_empty = impl.get_send_buffer().is_empty();
+        if (queued) {
+            if (old_size == 0) { send_queued_since = timer::get(); }
+            send_urgent |= urgent;
+            // Wake the I/O thread if there is something new for it to send or time
+            wake = old_size == 0 || urgent
+                || (old_size < COALESCE_FLUSH_SIZE && send_buffer.size() >= COALESCE_FLUSH_SIZE);
+        }
     }
-    if (was_empty && !is_empty) {
-        send_condition.notify_one();
+    if (wake) {
+        wake_sender();
     }
+    if (queued) { return send_result::QUEUED; }
+    return connected ? send_result::QUEUE_FULL : send_result::NOT_CONNECTED;
+}
+
+timer::duration_type repclient::send_delay(const timer::time_type now) {
+    const std::chrono::microseconds window(coalesce_window_us.load(std::memory_order_relaxed));
+    if (window.count() == 0 || send_urgent || impl.get_send_buffer().size() >= COALESCE_FLUSH_SIZE) {
+        return timer::duration_type::zero();
+    }
+    const auto due = send_queued_since + std::chrono::duration_cast<timer::duration_type>(window);
+    return due > now ? due - now : timer::duration_type::zero();
+}
+
+void repclient::connection_lost() {
+    {
+        std::unique_lock<std::mutex> lock(send_mutex);
+        connected = false;
+    }
+    send_condition.notify_all();
 }
 
 void repclient::send(const void *data, size_t length) {
     const auto op = [data, length](repclient_protocol &protocol) {
         return protocol.try_send(data, length);
     };
-    do_sending_operation(op);
+    do_sending_operation(op, true, false);
+}
+
+repclient::send_result repclient::try_send(const void *data, size_t length) {
+    const auto op = [data, length](repclient_protocol &protocol) {
+        return protocol.try_send(data, length);
+    };
+    return do_sending_operation(op, false, false);
+}
+
+void repclient::set_send_coalescing(const std::chrono::microseconds window) {
+    coalesce_window_us.store(window.count(), std::memory_order_relaxed);
+    wake_sender();
 }
 
 void repclient::authenticate_player_id(const uint64_t id) {
     const auto op = [id](repclient_protocol &protocol) {
         return protocol.try_authenticate_player_id(id);
     };
-    do_sending_operation(op);
+    do_sending_operation(op, true, true);
 }
 
 void repclient::authenticate_player_id_with_token(const uint64_t id, const std::array<unsigned char, 32>& token) {
     const auto op = [id, token](repclient_protocol &protocol) {
         return protocol.try_authenticate_player_id_with_token(id, token);
     };
-    do_sending_operation(op);
+    do_sending_operation(op, true, true);
 }
 
 void repclient::send_authentication_payload(const void *data, size_t length) {
     const auto op = [data, length](repclient_protocol &protocol) {
         return protocol.try_send_authentication_payload(data, length);
     };
-    do_sending_operation(op);
+    do_sending_operation(op, true, true);
 }
 
 
 void repclient::setup_threads() {
     assert(socket != INVALID_SOCKET);
+    connect_time = timer::get();
+#if defined(AETHER_REPCLIENT_EPOLL)
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        perror("epoll_create1");
+        abort();
+    }
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd < 0) {
+        perror("eventfd");
+        abort();
+    }
+    epoll_event socket_event{};
+    socket_event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    socket_event.data.fd = socket;
+    epoll_event wake_event{};
+    wake_event.events = EPOLLIN;
+    wake_event.data.fd = wake_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, socket, &socket_event) != 0
+        || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &wake_event) != 0) {
+        perror("epoll_ctl");
+        abort();
+    }
+    io_thread = std::thread(do_event_loop, std::ref(*this));
+#else
     send_thread = std::thread(do_sends, std::ref(*this));
     receive_thread = std::thread(do_receives, std::ref(*this));
+#endif
+}
+
+void repclient::wake_receiver() {
+#if defined(AETHER_REPCLIENT_EPOLL)
+    const uint64_t one = 1;
+    const auto ret = write(wake_fd, &one, sizeof(one));
+    (void) ret;
+#else
+    // Taking the lock ensures the receive thread is either waiting or has not yet
+    // checked for space
+    {
+        std::unique_lock<std::mutex> lock(receive_mutex);
+    }
+    receive_condition.notify_one();
+#endif
+}
+
+void repclient::wake_sender() {
+#if defined(AETHER_REPCLIENT_EPOLL)
+    const uint64_t one = 1;
+    const auto ret = write(wake_fd, &one, sizeof(one));
+    (void) ret;
+#else
+    // Senders waiting for space share the condition, so wake them all
+    send_condition.notify_all();
+#endif
 }
 
 repclient::~repclient() {
     const bool using_socket = client_mode == mode::LIVE ||
         client_mode == mode::RECORD;
 
-    const bool using_recfile = client_mode == mode::RECORD ||
-        client_mode == mode::PLAYBACK;
-
-    if (using_recfile) {
-        close_file(rec_file);
-    }
-
     if (using_socket) {
         alive = false;
-        send_condition.notify_one();
-        receive_condition.notify_one();
+        wake_sender();
+        wake_receiver();
+#if defined(AETHER_REPCLIENT_EPOLL)
+        io_thread.join();
+        close(wake_fd);
+        close(epoll_fd);
+#else
         send_thread.join();
         receive_thread.join();
+#endif
         tcp::close_socket(socket);
 
 #if defined(_WIN32)
@@ -0,0 +1,220 @@
+#include <aether/snapshot_buffer.hh>
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+
+namespace aether {
+
+namespace {
+
+// Weight of a new measurement in the tick interval and jitter estimates, as in the
+// RFC 3550 interarrival jitter estimator
+constexpr double ESTIMATE_GAIN = 1.0 / 16.0;
+
+// Fraction of the difference between the arrival time and the tick schedule that is
+// applied to sample times, so that the schedule follows clock drift but not jitter
+constexpr double SCHEDULE_GAIN = 1.0 / 8.0;
+
+protocol::base::net_quat normalize(const protocol::base::net_quat &q) {
+    const float length = std::sqrt(q.x * q.x + q.y * q.y + q.z * q.z + q.w * q.w);
+    if (length <= 0.0f) {
+        return protocol::base::net_quat{0.0f, 0.0f, 0.0f, 1.0f};
+    }
+    return protocol::base::net_quat{q.x / length, q.y / length, q.z / length, q.w / length};
+}
+
+protocol::base::net_quat slerp(const protocol::base::net_quat &a, protocol::base::net_quat b, const float t) {
+    float cos_theta = a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+    // q and -q are the same rotation, take the shorter way round
+    if (cos_theta < 0.0f) {
+        b = protocol::base::net_quat{-b.x, -b.y, -b.z, -b.w};
+        cos_theta = -cos_theta;
+    }
+
+    float wa = 1.0f - t;
+    float wb = t;
+    // Nearly parallel quaternions are lerped, as sin(theta) tends to zero
+    if (cos_theta < 0.9995f) {
+        const float theta = std::acos(cos_theta);
+        const float sin_theta = std::sin(theta);
+        wa = std::sin((1.0f - t) * theta) / sin_theta;
+        wb = std::sin(t * theta) / sin_theta;
+    }
+    return normalize(protocol::base::net_quat{
+        wa * a.x + wb * b.x,
+        wa * a.y + wb * b.y,
+        wa * a.z + wb * b.z,
+        wa * a.w + wb * b.w,
+    });
+}
+
+}
+
+snapshot_buffer::snapshot_buffer() : snapshot_buffer(options()) {
+}
+
+snapshot_buffer::snapshot_buffer(const options &_opts) : opts(_opts), playout_delay(_opts.min_delay) {
+}
+
+double snapshot_buffer::on_packet(const uint64_t worker_id, uint64_t tick, const double arrival_time) {
+    auto &clock = workers[worker_id];
+    ++clock.packets;
+    if (tick == 0) {
+        tick = clock.packets;
+    }
+
+    // The first packet, or a worker that has restarted its tick count
+    if (clock.packets == 1 || tick < clock.last_tick) {
+        clock = worker_clock();
+        clock.packets = 1;
+        clock.last_tick = tick;
+        clock.last_arrival = arrival_time;
+        clock.last_time = arrival_time;
+        return arrival_time;
+    }
+
+    // Packets from the same tick share a time
+    if (tick == clock.last_tick) {
+        return clock.last_time;
+    }
+
+    const double ticks = static_cast<double>(tick - clock.last_tick);
+    const double measured_interval = std::max(0.0, arrival_time - clock.last_arrival) / ticks;
+    if (clock.interval == 0.0) {
+        clock.interval = measured_interval;
+    } else {
+        clock.interval += (measured_interval - clock.interval) * ESTIMATE_GAIN;
+    }
+
+    const double predicted = clock.last_time + ticks * clock.interval;
+    const double deviation = arrival_time - predicted;
+    jitter += (std::abs(deviation) - jitter) * ESTIMATE_GAIN;
+
+    // Samples never carry a time later than they arrived, nor so early that they
+    // would already be behind the render time
+    double time = predicted + deviation * SCHEDULE_GAIN;
+    time = std::min(time, arrival_time);
+    time = std::max(time, arrival_time - opts.max_delay);
+    time = std::max(time, clock.last_time);
+
+    clock.last_tick = tick;
+    clock.last_arrival = arrival_time;
+    clock.last_time = time;
+    return time;
+}
+
+void snapshot_buffer::add(const uint64_t entity_id, const double time, const state &sample) {
+    auto &samples = entities[entity_id];
+    auto it = samples.end();
+    while (it != samples.begin() && std::prev(it)->time > time) {
+        --it;
+    }
+    if (it != samples.begin() && std::prev(it)->time == time) {
+        std::prev(it)->value = sample;
+    } else {
+        samples.insert(it, timed_state{time, sample});
+    }
+    while (samples.size() > std::max<size_t>(opts.max_samples, 2)) {
+        samples.pop_front();
+    }
+}
+
+void snapshot_buffer::remove(const uint64_t entity_id) {
+    entities.erase(entity_id);
+}
+
+void snapshot_buffer::remove_worker(const uint64_t worker_id) {
+    workers.erase(worker_id);
+}
+
+void snapshot_buffer::clear() {
+    entities.clear();
+    workers.clear();
+    jitter = 0.0;
+    advanced = false;
+}
+
+double snapshot_buffer::target_delay() const {
+    const double target = get_tick_interval() + opts.jitter_multiplier * jitter;
+    return std::min(std::max(target, opts.min_delay), opts.max_delay);
+}
+
+void snapshot_buffer::advance(const double now) {
+    const double target = target_delay();
+    if (!advanced) {
+        playout_delay = target;
+        render_time = now - playout_delay;
+        last_advance = now;
+        advanced = true;
+        return;
+    }
+
+    const double max_step = opts.delay_slew_rate * std::max(0.0, now - last_advance);
+    playout_delay += std::min(std::max(target - playout_delay, -max_step), max_step);
+    // The render time only moves forwards, even if the delay grows faster than time
+    render_time = std::max(render_time, now - playout_delay);
+    last_advance = now;
+
+    // Only the last sample at or before the render time is still needed
+    for (auto &entry : entities) {
+        auto &samples = entry.second;
+        while (samples.size() > 2 && samples[1].time <= render_time) {
+            samples.pop_front();
+        }
+    }
+}
+
+bool snapshot_buffer::sample(const uint64_t entity_id, state &out) const {
+    const auto found = entities.find(entity_id);
+    if (found == entities.end() || found->second.empty()) {
+        return false;
+    }
+
+    const auto &samples = found->second;
+    if (render_time <= samples.front().time) {
+        out = samples.front().value;
+        return true;
+    }
+    if (render_time >= samples.back().time) {
+        const timed_state &last = samples.back();
+        const double elapsed = std::min(render_time - last.time, opts.max_extrapolation);
+        out = last.value;
+        out.position = last.value.position + last.value.velocity * static_cast<float>(elapsed);
+        return true;
+    }
+
+    size_t next = 1;
+    while (samples[next].time <= render_time) {
+        ++next;
+    }
+    const timed_state &a = samples[next - 1];
+    const timed_state &b = samples[next];
+    const float t = static_cast<float>((render_time - a.time) / (b.time - a.time));
+    out.position = a.value.position + (b.value.position - a.value.position) * t;
+    out.orientation = slerp(a.value.orientation, b.value.orientation, t);
+    out.velocity = a.value.velocity + (b.value.velocity - a.value.velocity) * t;
+    return true;
+}
+
+double snapshot_buffer::get_render_time() const {
+    return render_time;
+}
+
+double snapshot_buffer::get_playout_delay() const {
+    return playout_delay;
+}
+
+double snapshot_buffer::get_jitter() const {
+    return jitter;
+}
+
+double snapshot_buffer::get_tick_interval() const {
+    double interval = 0.0;
+    for (const auto &entry : workers) {
+        interval = std::max(interval, entry.second.interval);
+    }
+    return interval;
+}
+
+}
@@ -1,13 +1,22 @@
+#include <algorithm>
 #include <iostream>
 #include <physx_client.hh>
 
-void physx_client::process_packet(void *message_data, size_t count) {
+void physx_client::process_packet(const void *message_data, size_t count, const double arrival_time) {
     auto demarshaller = aether::netcode::trivial_marshalling<trivial_marshalling_traits>().create_demarshaller();
     const bool success = demarshaller.decode(message_data, count);
     assert(success && "Failed to decode packet from simulation");
 
+    // Entities are not tagged with the worker that sent them, so a packet carrying
+    // several workers' state is timed by the latest of their headers
+    double sample_time = arrival_time;
+    bool have_sample_time = false;
     const auto headers = demarshaller.get_worker_data();
     for(const auto &[id, header] : headers) {
+        const double worker_time = snapshots.on_packet(id, header.tick, arrival_time);
+        sample_time = have_sample_time ? std::max(sample_time, worker_time) : worker_time;
+        have_sample_time = true;
+
         if (id + 1 > num_workers) {
             cells.resize(id + 1);
             vertices.resize(id + 1);
@@ -26,12 +35,20 @@ void physx_client::process_packet(void *message_data, size_t count) {
             cells[id].code = 0;
             cells[id].level = -1;
             cells[id].pid = 0;
+            snapshots.remove_worker(id);
         }
     }
 
     const auto message_entities = demarshaller.get_entities();
     for(size_t entity_id = 0; entity_id < message_entities.size(); ++entity_id) {
         const auto &entity = message_entities[entity_id];
+        const auto id = get_entity_id(entity);
+        if (protocol::base::is_entity_dead(entity) || protocol::base::is_entity_dropped(entity)) {
+            entities.erase(id);
+            snapshots.remove(id);
+            continue;
+        }
+
         const vec3f position = protocol::base::net_decode_position_3f(entity.net_encoded_position);
         ui_point point;
         point.p = { position.x, position.y, position.z };
@@ -47,8 +64,9 @@ void physx_client::process_packet(void *message_data, size_t count) {
         // please note that net_quat contains floats in the following order float x, y, z, w;  (w is the last variable here)
         point.quat = entity.net_encoded_orientation; 
 
-        const auto id = get_entity_id(entity);
         entities[id] = point;
+        const vec3f velocity = protocol::base::get_velocity(entity);
+        snapshots.add(id, sample_time, aether::snapshot_buffer::state{position, point.quat, velocity});
     }
 }
 
@@ -178,6 +196,8 @@ void physx_client::key_callback(GLFWwindow* window, int key, int scancode, int a
     } else if (key >= GLFW_KEY_0 && key <= GLFW_KEY_9) {
         current_player = key - GLFW_KEY_0;
         me->authenticate();
+    } else if (key == GLFW_KEY_I) {
+        me->interpolate_entities = !me->interpolate_entities;
     }
 }
 
@@ -423,9 +443,14 @@ void physx_client::print_statistics() {
                 vertices[i].stats.num_agents_ghost;
         }
     }
-    printf("Total: num_agents=%" PRIu64 ", num_ghost=%" PRIu64 "\n\n",
+    printf("Total: num_agents=%" PRIu64 ", num_ghost=%" PRIu64 "\n",
            client_stats_accum.num_agents,
            client_stats_accum.num_agents_ghost);
+    printf("Interpolation: %s, delay=%.1fms, jitter=%.1fms, tick=%.1fms\n\n",
+           interpolate_entities ? "on" : "off",
+           snapshots.get_playout_delay() * 1000.0,
+           snapshots.get_jitter() * 1000.0,
+           snapshots.get_tick_interval() * 1000.0);
     fflush(stdout);
 }
 
@@ -450,13 +475,12 @@ bool physx_client::tick() {
     glClearColor(1.0, 1.0, 1.0, 1.0);
     glClearDepth(1);
     glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
-    size_t msg_size;
-    for (void * msg; (msg = repstate.tick(&msg_size)); ) {
-		process_packet(msg, msg_size);
+    repstate.tick_batch([this](const repclient::message_view &msg) {
+        process_packet(msg.data, msg.length, msg.arrival_time.count());
         statistic stat;
-        stat.bytes = msg_size;
+        stat.bytes = msg.length;
         stats += stat;
-    }
+    });
 
     const bool debug_interaction = false;
     if (debug_interaction && current_frame % 100 == 0) {
@@ -475,8 +499,14 @@ bool physx_client::tick() {
 
     std::vector<ui_point> entity_vertices;
     entity_vertices.reserve(entities.size());
-    for(const auto &[_, entity] : entities) {
+    snapshots.advance(repstate.current_time().count());
+    for(const auto &[id, entity] : entities) {
         entity_vertices.push_back(entity);
+        aether::snapshot_buffer::state interpolated;
+        if (interpolate_entities && snapshots.sample(id, interpolated)) {
+            entity_vertices.back().p = interpolated.position;
+            entity_vertices.back().quat = interpolated.orientation;
+        }
     }
 
     //setup mvp matrix for entities
@@ -11,6 +11,7 @@
 #include <unordered_map>
 
 #include <aether/repclient.hh>
+#include <aether/snapshot_buffer.hh>
 #include <aether/common/statistics.hh>
 #include <aether/common/vector.hh>
 #include <aether/common/colour.hh>
@@ -29,7 +30,7 @@
 
 struct trivial_marshalling_traits {
     using per_worker_data_type = protocol::base::client_message;
-    using entity_type = protocol::base::net_point_3d;
+    using entity_type = protocol::base::net_moving_point_3d;
     using static_data_type = std::monostate;
 };
 
@@ -64,7 +65,7 @@ struct physx_client {
     void update_camera();
     void print_statistics();
     vec2f unproject(const vec2f &position);
-    void process_packet(void *message_data, size_t count);
+    void process_packet(const void *message_data, size_t count, double arrival_time);
     void authenticate();
     ~physx_client();
 
@@ -75,6 +76,10 @@ struct physx_client {
     uint64_t num_workers = 0;
     std::vector<protocol::base::net_tree_cell> cells;
     std::unordered_map<uint64_t, ui_point> entities;
+    // Draws entities between received states rather than at the latest one, and
+    // extrapolates those the muxer holds back while dead reckoning
+    bool interpolate_entities = true;
+    aether::snapshot_buffer snapshots;
 
     repclient repstate;
     GLint p_mvp_location, l_mvp_location;
@@ -0,0 +1,585 @@
+// Micro-benchmarks for the aether-sdk code used by the simulation, muxer and client.
+// Everything runs in-process on deterministic synthetic data, so no Hadean or PhysX
+// runtime is needed. Results are written as JSON.
+//
+// Usage: aether_sdk_bench [--entities N] [--queries N] [--min-time-ms T] [--seed S]
+//                         [--filter SUBSTRING] [--output FILE]
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <variant>
+#include <vector>
+
+#include <aether/common/base_protocol.hh>
+#include <aether/common/compression.hh>
+#include <aether/common/container/max_heap.hh>
+#include <aether/common/container/ring_buffer.hh>
+#include <aether/common/morton/AABB.hh>
+#include <aether/common/morton/encoding.hh>
+#include <aether/common/netcode/range_coder.hh>
+#include <aether/common/netcode/transcode.hh>
+#include <aether/generic-netcode/entity_store.hh>
+#include <aether/generic-netcode/spatial_index.hh>
+#include <aether/generic-netcode/trivial_marshalling.hh>
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+using entity_type = protocol::base::net_point_3d;
+
+struct bench_traits {
+    using per_worker_data_type = protocol::base::client_message;
+    using entity_type = protocol::base::net_point_3d;
+    using static_data_type = std::monostate;
+};
+
+struct bench_config {
+    size_t entities = 10000;
+    size_t queries = 1000;
+    double min_time_ms = 200.0;
+    uint64_t seed = 1;
+    std::string filter;
+    std::string output;
+};
+
+struct bench_result {
+    std::string name;
+    size_t items;
+    size_t runs;
+    double ns_per_item;
+    double items_per_second;
+    // Size of the encoded output per item. Negative if not applicable.
+    double bytes_per_item;
+};
+
+// Stops the optimiser discarding benchmarked work
+volatile uint64_t sink;
+
+class bench_runner {
+private:
+    const bench_config &config;
+    std::vector<bench_result> results;
+
+public:
+    explicit bench_runner(const bench_config &_config) : config(_config) {
+    }
+
+    // Runs `body` repeatedly until `min_time_ms` has elapsed (and at least 3 times), then
+    // records the median time per item. `body` processes `items` items per call and
+    // returns the number of bytes it produced, or 0. `setup`, if given, runs untimed before
+    // each call, so that every call starts from the same state.
+    void run(const std::string &name, const size_t items, const std::function<size_t()> &body,
+             const std::function<void()> &setup = {}) {
+        if (!config.filter.empty() && name.find(config.filter) == std::string::npos) {
+            return;
+        }
+        if (setup) {
+            setup();
+        }
+        body();
+
+        std::vector<double> samples;
+        size_t bytes = 0;
+        const auto start = clock_type::now();
+        while (samples.size() < 3 ||
+            std::chrono::duration<double, std::milli>(clock_type::now() - start).count() < config.min_time_ms) {
+            if (setup) {
+                setup();
+            }
+            const auto run_start = clock_type::now();
+            bytes = body();
+            const auto run_end = clock_type::now();
+            samples.push_back(std::chrono::duration<double, std::nano>(run_end - run_start).count());
+        }
+
+        std::nth_element(samples.begin(), samples.begin() + samples.size() / 2, samples.end());
+        const double median = samples[samples.size() / 2];
+        const double per_item = items == 0 ? 0.0 : median / items;
+        bench_result result;
+        result.name = name;
+        result.items = items;
+        result.runs = samples.size();
+        result.ns_per_item = per_item;
+        result.items_per_second = per_item > 0.0 ? 1e9 / per_item : 0.0;
+        result.bytes_per_item = bytes == 0 || items == 0 ? -1.0 : static_cast<double>(bytes) / items;
+        results.push_back(result);
+        fprintf(stderr, "%-40s %12.2f ns/item\n", name.c_str(), per_item);
+    }
+
+    void write_json(FILE *out) const {
+        fprintf(out, "{\n  \"config\": {\"entities\": %zu, \"queries\": %zu, \"min_time_ms\": %g, \"seed\": %llu},\n",
+            config.entities, config.queries, config.min_time_ms, static_cast<unsigned long long>(config.seed));
+        fprintf(out, "  \"results\": [\n");
+        for (size_t i = 0; i < results.size(); ++i) {
+            const auto &r = results[i];
+            fprintf(out, "    {\"name\": \"%s\", \"items\": %zu, \"runs\": %zu, \"ns_per_item\": %.3f, "
+                "\"items_per_second\": %.1f",
+                r.name.c_str(), r.items, r.runs, r.ns_per_item, r.items_per_second);
+            if (r.bytes_per_item >= 0.0) {
+                fprintf(out, ", \"bytes_per_item\": %.3f", r.bytes_per_item);
+            }
+            fprintf(out, "}%s\n", i + 1 < results.size() ? "," : "");
+        }
+        fprintf(out, "  ]\n}\n");
+    }
+};
+
+float uniform(std::mt19937_64 &rng, const float lo, const float hi) {
+    return std::uniform_real_distribution<float>(lo, hi)(rng);
+}
+
+// A cell of bodies with ids in a few dense runs, as produced by several workers
+std::vector<entity_type> make_entities(const bench_config &config, std::mt19937_64 &rng) {
+    std::vector<entity_type> entities(config.entities);
+    uint64_t next_id = 1;
+    for (auto &entity : entities) {
+        if (rng() % 64 == 0) {
+            next_id += rng() % 1024;
+        }
+        entity.id = next_id++;
+        entity.net_encoded_position = vec3f(uniform(rng, -500, 500), uniform(rng, -500, 500), uniform(rng, 0, 100));
+        float q[4] = { uniform(rng, -1, 1), uniform(rng, -1, 1), uniform(rng, -1, 1), uniform(rng, -1, 1) };
+        const float norm = std::sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+        entity.net_encoded_orientation = { q[0] / norm, q[1] / norm, q[2] / norm, q[3] / norm };
+        entity.net_encoded_color = static_cast<uint32_t>(rng());
+        entity.owner_id = 0;
+        entity.size = uniform(rng, 0.5f, 2.0f);
+        entity.flags = 0;
+    }
+    std::shuffle(entities.begin(), entities.end(), rng);
+    return entities;
+}
+
+// Checks that the marshaller decodes what it encodes, before it is timed. Sorted ids come
+// back in id order.
+bool marshalling_round_trips(const aether::netcode::trivial_marshalling<bench_traits> &factory,
+                             std::vector<entity_type> entities, const bool sorted) {
+    auto marshaller = factory.create_marshaller();
+    marshaller.add_worker_data(0, protocol::base::client_message{});
+    for (const auto &entity : entities) {
+        marshaller.add_entity(entity);
+    }
+    const auto encoded = marshaller.encode();
+
+    auto demarshaller = factory.create_demarshaller();
+    if (!demarshaller.decode(encoded.data(), encoded.size())) {
+        return false;
+    }
+    if (sorted) {
+        std::stable_sort(entities.begin(), entities.end(), [](const entity_type &a, const entity_type &b) {
+            return a.id < b.id;
+        });
+    }
+    const auto decoded = demarshaller.get_entities();
+    return decoded.size() == entities.size() &&
+        std::memcmp(decoded.data(), entities.data(), entities.size() * sizeof(entity_type)) == 0;
+}
+
+// Id sets at the edges of the id encodings: a dense run, duplicates, and ids spread over
+// the whole 64-bit range, whose span does not fit a bitset
+std::vector<std::vector<entity_type>> make_edge_case_entities(const std::vector<entity_type> &entities) {
+    const std::vector<std::vector<uint64_t>> id_sets = {
+        {},
+        {7},
+        {5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16},
+        {3, 3, 9, 9, 1},
+        {0, 1ull << 63, UINT64_MAX - 1},
+        {UINT64_MAX, 0, UINT64_MAX - 2},
+    };
+    std::vector<std::vector<entity_type>> cases;
+    for (const auto &ids : id_sets) {
+        std::vector<entity_type> edge_case;
+        for (size_t i = 0; i < ids.size() && !entities.empty(); ++i) {
+            edge_case.push_back(entities[i % entities.size()]);
+            edge_case.back().id = ids[i];
+        }
+        cases.push_back(edge_case);
+    }
+    return cases;
+}
+
+void bench_marshalling(bench_runner &runner, const std::vector<entity_type> &entities) {
+    for (const bool sorted : { false, true }) {
+        const std::string suffix = sorted ? "_sorted_ids" : "";
+        const aether::netcode::trivial_marshalling<bench_traits> factory(sorted);
+        for (const auto &edge_case : make_edge_case_entities(entities)) {
+            if (!marshalling_round_trips(factory, edge_case, sorted)) {
+                fprintf(stderr, "trivial_marshaller%s failed to round trip %zu edge case entities\n",
+                    suffix.c_str(), edge_case.size());
+                abort();
+            }
+        }
+        if (!marshalling_round_trips(factory, entities, sorted)) {
+            fprintf(stderr, "trivial_marshaller%s failed to round trip the benchmark entities\n", suffix.c_str());
+            abort();
+        }
+        const auto encode = [&]() {
+            auto marshaller = factory.create_marshaller();
+            marshaller.reserve(entities.size());
+            marshaller.add_worker_data(0, protocol::base::client_message{});
+            for (const auto &entity : entities) {
+                marshaller.add_entity(entity);
+            }
+            return marshaller.encode();
+        };
+        runner.run("trivial_marshaller_encode" + suffix, entities.size(), [&]() {
+            return encode().size();
+        });
+
+        const auto encoded = encode();
+        runner.run("trivial_marshaller_decode" + suffix, entities.size(), [&]() {
+            auto demarshaller = factory.create_demarshaller();
+            demarshaller.decode(encoded.data(), encoded.size());
+            sink = demarshaller.get_entities().size();
+            return size_t(0);
+        });
+    }
+}
+
+// `values_per_item` is the number of integers in each `T`, so grouped coders report
+// their time per integer
+template<typename Coder, typename T>
+void bench_coder(bench_runner &runner, const std::string &name, const std::vector<T> &values, const size_t values_per_item = 1) {
+    using namespace aether::netcode::transcode;
+    std::vector<uint8_t> encoded;
+    const auto encode = [&]() {
+        encoded.clear();
+        Coder coder;
+        bit_appender appender(encoded, 0);
+        for (const auto &v : values) {
+            coder.encode(v, appender);
+        }
+        return encoded.size();
+    };
+    const size_t items = values.size() * values_per_item;
+    runner.run(name + "_encode", items, encode);
+    encode();
+    runner.run(name + "_decode", items, [&]() {
+        Coder coder;
+        bit_stream stream(encoded, encoded.size() * CHAR_BIT);
+        T out{};
+        for (size_t i = 0; i < values.size(); ++i) {
+            coder.decode(stream, out);
+        }
+        sink = *reinterpret_cast<const uint8_t *>(&out);
+        return size_t(0);
+    });
+}
+
+template<typename Coder, typename T>
+void bench_range_coder(bench_runner &runner, const std::string &name, const std::vector<T> &values) {
+    using namespace aether::netcode::transcode;
+    std::vector<uint8_t> encoded;
+    const auto encode = [&]() {
+        encoded.clear();
+        Coder coder;
+        range_appender appender(encoded);
+        for (const auto &v : values) {
+            coder.encode(v, appender);
+        }
+        appender.finish();
+        return encoded.size();
+    };
+    runner.run(name + "_encode", values.size(), encode);
+    encode();
+    runner.run(name + "_decode", values.size(), [&]() {
+        Coder coder;
+        range_stream stream(encoded);
+        T out{};
+        for (size_t i = 0; i < values.size(); ++i) {
+            coder.decode(stream, out);
+        }
+        sink = static_cast<uint64_t>(out);
+        return size_t(0);
+    });
+}
+
+void bench_transcode(bench_runner &runner, const std::vector<entity_type> &entities, std::mt19937_64 &rng) {
+    using namespace aether::netcode::transcode;
+    std::vector<uint64_t> ids;
+    std::vector<float> positions;
+    for (const auto &entity : entities) {
+        ids.push_back(entity.id);
+        positions.push_back(entity.net_encoded_position.x);
+    }
+    std::sort(ids.begin(), ids.end());
+
+    // Positions of one body over consecutive ticks
+    std::vector<float> trajectory(entities.size());
+    float x = 0.0f, v = 0.0f;
+    for (auto &p : trajectory) {
+        v += uniform(rng, -0.01f, 0.01f);
+        x += v;
+        p = x;
+    }
+
+    std::vector<int64_t> small_ints(entities.size());
+    for (auto &i : small_ints) {
+        i = static_cast<int64_t>(rng() % 4096) - 2048;
+    }
+
+    bench_coder<unbounded_integer_delta<uint64_t>>(runner, "transcode_id_delta_variable_int", ids);
+    bench_coder<unbounded_integer_delta<uint64_t, prefix_varint<int64_t>>>(runner, "transcode_id_delta_prefix_varint", ids);
+    std::vector<std::array<uint64_t, 4>> id_groups;
+    for (size_t i = 0; i + 4 <= ids.size(); i += 4) {
+        id_groups.push_back({ ids[i], ids[i + 1], ids[i + 2], ids[i + 3] });
+    }
+    bench_coder<unbounded_integer_delta_group<uint64_t>, std::array<uint64_t, 4>>(runner, "transcode_id_delta_group_varint", id_groups, 4);
+    bench_coder<variable_int<int64_t>>(runner, "transcode_variable_int", small_ints);
+    bench_coder<prefix_varint<int64_t>>(runner, "transcode_prefix_varint", small_ints);
+    bench_coder<scaled_fixed_point_delta<float, 1000>>(runner, "transcode_fixed_point_delta_random", positions);
+    bench_coder<scaled_fixed_point_delta<float, 1000>>(runner, "transcode_fixed_point_delta_trajectory", trajectory);
+    bench_range_coder<range_integer_delta<uint64_t>>(runner, "range_coder_id_delta", ids);
+    bench_range_coder<range_fixed_point_delta<float, 1000>>(runner, "range_coder_fixed_point_delta_trajectory", trajectory);
+}
+
+void bench_packed_writer(bench_runner &runner, const std::vector<entity_type> &entities) {
+    using namespace aether::compression;
+    runner.run("packed_writer_entity", entities.size(), [&]() {
+        packed_writer writer(std::make_unique<compression_config>());
+        const auto &config = writer.get_config();
+        writer.reserve_bits(entities.size() * 128);
+        for (const auto &entity : entities) {
+            const auto &o = entity.net_encoded_orientation;
+            writer.append_quat(net_quat{ o.x, o.y, o.z, o.w });
+            writer.append_velocity(vec3f(entity.size, -entity.size, entity.size));
+            writer.append_float_packed(&entity.size, config.size_max_size, config.size_min_size, config.size_precision);
+            writer.append_4_b(&entity.net_encoded_color);
+        }
+        return writer.get_size_bytes();
+    });
+}
+
+void bench_spatial_index(bench_runner &runner, const bench_config &config, const std::vector<entity_type> &entities, std::mt19937_64 &rng) {
+    using store_type = aether::netcode::entity_store<entity_type>;
+    using aether::netcode::entity_handle;
+    const store_type::metadata_type metadata{ 0, store_type::time_point(), 0 };
+
+    runner.run("spatial_index_insert_commit", entities.size(), [&]() {
+        store_type store;
+        aether::netcode::spatial_index<store_type> index(store);
+        for (const auto &entity : entities) {
+            index.update_entity(store.new_entity(metadata, entity.id, entity));
+        }
+        index.commit();
+        return size_t(0);
+    });
+
+    store_type store;
+    aether::netcode::spatial_index<store_type> index(store);
+    std::vector<entity_handle> handles;
+    for (const auto &entity : entities) {
+        handles.push_back(store.new_entity(metadata, entity.id, entity));
+        index.update_entity(handles.back());
+    }
+    index.commit();
+
+    // Every run moves each entity by the same step from its original position, so that runs
+    // do the same work and the index is left as it was for the queries
+    std::vector<std::array<float, 2>> steps(entities.size());
+    for (auto &step : steps) {
+        step = {uniform(rng, -2.0f, 2.0f), uniform(rng, -2.0f, 2.0f)};
+    }
+    const auto reset_positions = [&]() {
+        for (size_t i = 0; i < handles.size(); ++i) {
+            store.update_entity(metadata, handles[i], entities[i]);
+            index.update_entity(handles[i]);
+        }
+        index.commit();
+    };
+    runner.run("spatial_index_update_commit", entities.size(), [&]() {
+        for (size_t i = 0; i < handles.size(); ++i) {
+            entity_type entity = entities[i];
+            entity.net_encoded_position.x += steps[i][0];
+            entity.net_encoded_position.y += steps[i][1];
+            store.update_entity(metadata, handles[i], entity);
+            index.update_entity(handles[i]);
+        }
+        index.commit();
+        return size_t(0);
+    }, reset_positions);
+    reset_positions();
+
+    std::vector<vec3f> centres(config.queries);
+    for (auto &centre : centres) {
+        centre = vec3f(uniform(rng, -500, 500), uniform(rng, -500, 500), uniform(rng, 0, 100));
+    }
+    runner.run("spatial_index_query_exact_r50", centres.size(), [&]() {
+        size_t found = 0;
+        for (const auto &centre : centres) {
+            found += index.find_entities_exact(centre, 50.0).size();
+        }
+        sink = found;
+        return size_t(0);
+    });
+}
+
+void bench_max_heap(bench_runner &runner, const std::vector<entity_type> &entities, std::mt19937_64 &rng) {
+    std::vector<uint64_t> priorities(entities.size());
+    for (auto &p : priorities) {
+        p = rng();
+    }
+
+    runner.run("max_heap_push_pop", entities.size(), [&]() {
+        aether::container::max_heap<uint64_t, uint64_t> heap;
+        for (size_t i = 0; i < entities.size(); ++i) {
+            heap.push(entities[i].id, priorities[i]);
+        }
+        uint64_t total = 0;
+        while (!heap.empty()) {
+            total += heap.peek()->first;
+            heap.pop();
+        }
+        sink = total;
+        return size_t(0);
+    });
+
+    std::vector<uint64_t> reprioritised(entities.size());
+    for (size_t i = 0; i < entities.size(); ++i) {
+        reprioritised[i] = priorities[i] ^ rng();
+    }
+    aether::container::max_heap<uint64_t, uint64_t> heap;
+    runner.run("max_heap_reprioritise", entities.size(), [&]() {
+        for (size_t i = 0; i < entities.size(); ++i) {
+            heap.push(entities[i].id, reprioritised[i]);
+        }
+        return size_t(0);
+    }, [&]() {
+        heap = aether::container::max_heap<uint64_t, uint64_t>();
+        for (size_t i = 0; i < entities.size(); ++i) {
+            heap.push(entities[i].id, priorities[i]);
+        }
+    });
+}
+
+void bench_morton(bench_runner &runner, const bench_config &config, const std::vector<entity_type> &entities, std::mt19937_64 &rng) {
+    using morton_type = morton_code<3, 21>;
+    runner.run("morton_3_encode", entities.size(), [&]() {
+        uint64_t total = 0;
+        for (const auto &entity : entities) {
+            total += morton_3_encode(entity.net_encoded_position).data;
+        }
+        sink = total;
+        return size_t(0);
+    });
+
+    std::vector<aether::morton::AABB<morton_type>> boxes;
+    for (size_t i = 0; i < config.queries; ++i) {
+        std::array<int32_t, 3> lo, hi;
+        for (size_t d = 0; d < 3; ++d) {
+            lo[d] = static_cast<int32_t>(rng() % 4096) - 2048;
+            hi[d] = lo[d] + static_cast<int32_t>(rng() % 64);
+        }
+        boxes.emplace_back(morton_type::encode(lo), morton_type::encode(hi));
+        if (boxes.back().max < boxes.back().min) {
+            boxes.pop_back();
+        }
+    }
+    runner.run("aabb_to_region", boxes.size(), [&]() {
+        size_t intervals = 0;
+        for (const auto &box : boxes) {
+            const auto region = box.to_region();
+            intervals += region.intervals.size();
+        }
+        sink = intervals;
+        return size_t(0);
+    });
+}
+
+void bench_ring_buffer(bench_runner &runner, const bench_config &config, std::mt19937_64 &rng) {
+    constexpr size_t capacity = 512 * 1024;
+    constexpr size_t chunk = 1400;
+    std::vector<char> input(chunk), output(chunk);
+    for (auto &c : input) {
+        c = static_cast<char>(rng());
+    }
+    const size_t chunks = std::max<size_t>(config.entities / 10, 1);
+    runner.run("ring_buffer_write_read_1400b", chunks, [&]() {
+        aether::container::ring_buffer<char> buffer(capacity);
+        size_t total = 0;
+        for (size_t i = 0; i < chunks; ++i) {
+            buffer.write(input.data(), chunk);
+            // Read in two parts so the head wraps around the end of the buffer
+            total += buffer.try_read(output.data(), chunk / 2);
+            total += buffer.try_read(output.data(), chunk - chunk / 2);
+        }
+        sink = total;
+        return size_t(0);
+    });
+}
+
+bool parse_args(int argc, const char *const *argv, bench_config &config) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const auto next = [&]() -> const char * {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Missing value for %s\n", arg.c_str());
+                exit(EXIT_FAILURE);
+            }
+            return argv[++i];
+        };
+        if (arg == "--entities") {
+            config.entities = std::strtoull(next(), nullptr, 10);
+        } else if (arg == "--queries") {
+            config.queries = std::strtoull(next(), nullptr, 10);
+        } else if (arg == "--min-time-ms") {
+            config.min_time_ms = std::strtod(next(), nullptr);
+        } else if (arg == "--seed") {
+            config.seed = std::strtoull(next(), nullptr, 10);
+        } else if (arg == "--filter") {
+            config.filter = next();
+        } else if (arg == "--output") {
+            config.output = next();
+        } else {
+            fprintf(stderr, "Usage: %s [--entities N] [--queries N] [--min-time-ms T] [--seed S] "
+                "[--filter SUBSTRING] [--output FILE]\n", argv[0]);
+            return false;
+        }
+    }
+    return config.entities > 0;
+}
+
+}
+
+int main(int argc, const char *const *argv) {
+    bench_config config;
+    if (!parse_args(argc, argv, config)) {
+        return EXIT_FAILURE;
+    }
+
+    std::mt19937_64 rng(config.seed);
+    const auto entities = make_entities(config, rng);
+    bench_runner runner(config);
+
+    bench_marshalling(runner, entities);
+    bench_transcode(runner, entities, rng);
+    bench_packed_writer(runner, entities);
+    bench_spatial_index(runner, config, entities, rng);
+    bench_max_heap(runner, entities, rng);
+    bench_morton(runner, config, entities, rng);
+    bench_ring_buffer(runner, config, rng);
+
+    FILE *out = stdout;
+    if (!config.output.empty()) {
+        out = fopen(config.output.c_str(), "w");
+        if (out == nullptr) {
+            perror("fopen");
+            return EXIT_FAILURE;
+        }
+    }
+    runner.write_json(out);
+    if (out != stdout) {
+        fclose(out);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,82 @@
+#include "cell_broadphase.hh"
+
+#include <aether/common/logging.hh>
+#include <fmt/format.h>
+#include <cstdlib>
+
+cell_broadphase::cell_broadphase(const float _ghost_margin) : ghost_margin(_ghost_margin) {
+}
+
+void cell_broadphase::configure(physx::PxSceneDesc &desc) {
+    desc.broadPhaseType = physx::PxBroadPhaseType::eMBP;
+    desc.broadPhaseCallback = this;
+}
+
+bool cell_broadphase::update(physx::PxScene &scene, const physx::PxBounds3 &cell_bounds) {
+    if (!bounds.isEmpty() && bounds.minimum == cell_bounds.minimum && bounds.maximum == cell_bounds.maximum) {
+        return false;
+    }
+
+    physx::PxBounds3 covered = cell_bounds;
+    covered.fattenFast(ghost_margin);
+    physx::PxBounds3 regions[SUBDIVISIONS * SUBDIVISIONS];
+    const physx::PxU32 num_regions = physx::PxBroadPhaseExt::createRegionsFromWorldBounds(regions, covered, SUBDIVISIONS, UP_AXIS);
+
+    // The new regions are added, and populated with the objects already in the scene, before
+    // the old ones are removed so that nothing is out of bounds in between
+    std::vector<physx::PxU32> new_handles;
+    new_handles.reserve(num_regions);
+    for (physx::PxU32 i = 0; i < num_regions; ++i) {
+        physx::PxBroadPhaseRegion region;
+        region.bounds = regions[i];
+        region.userData = nullptr;
+        const physx::PxU32 handle = scene.addBroadPhaseRegion(region, true);
+        if (handle == 0xffffffff) {
+            AETHER_LOG(ERROR)(fmt::format("Failed to add broadphase region {} of {}", i, num_regions));
+            abort();
+        }
+        new_handles.push_back(handle);
+    }
+    for (const physx::PxU32 handle : handles) {
+        scene.removeBroadPhaseRegion(handle);
+    }
+    handles = std::move(new_handles);
+    bounds = cell_bounds;
+    ++rebuilds;
+    return true;
+}
+
+broadphase_stats cell_broadphase::get_stats(const physx::PxScene &scene) const {
+    broadphase_stats stats;
+    stats.out_of_bounds = out_of_bounds;
+    stats.rebuilds = rebuilds;
+
+    std::vector<physx::PxBroadPhaseRegionInfo> infos(scene.getNbBroadPhaseRegions());
+    stats.regions = scene.getBroadPhaseRegions(infos.data(), static_cast<physx::PxU32>(infos.size()));
+    for (physx::PxU32 i = 0; i < stats.regions; ++i) {
+        stats.static_objects += infos[i].nbStaticObjects;
+        stats.dynamic_objects += infos[i].nbDynamicObjects;
+    }
+
+    physx::PxSimulationStatistics simulation;
+    scene.getSimulationStatistics(simulation);
+    stats.adds = simulation.getNbBroadPhaseAdds();
+    stats.removes = simulation.getNbBroadPhaseRemoves();
+    stats.pairs = simulation.nbDiscreteContactPairsTotal;
+    return stats;
+}
+
+void cell_broadphase::onObjectOutOfBounds(physx::PxShape&, physx::PxActor&) {
+    count_out_of_bounds();
+}
+
+void cell_broadphase::onObjectOutOfBounds(physx::PxAggregate&) {
+    count_out_of_bounds();
+}
+
+void cell_broadphase::count_out_of_bounds() {
+    if (out_of_bounds++ == 0) {
+        AETHER_LOG(WARN)(fmt::format("An object left the broadphase regions, which reach {} past the cell. "
+            "It will not collide until it is back in one.", ghost_margin));
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include <PxPhysicsAPI.h>
+
+struct broadphase_stats {
+    // Regions of the scene, and the objects in them. An object in several regions is
+    // counted in each.
+    uint32_t regions = 0;
+    uint32_t static_objects = 0;
+    uint32_t dynamic_objects = 0;
+    // Objects that have left every region since the broadphase was created, which PhysX
+    // no longer collides until they are back in one
+    uint64_t out_of_bounds = 0;
+    // Times the regions have been rebuilt for a new cell
+    uint64_t rebuilds = 0;
+    // From the last step
+    uint32_t adds = 0;
+    uint32_t removes = 0;
+    uint32_t pairs = 0;
+};
+
+// The multi-box-pruning broadphase of a cell's scene. The default sweep-and-prune
+// broadphase sorts every object in the scene along one axis, however far apart they are.
+// MBP instead sorts within regions, which here are a grid over the cell and the margin
+// around it in which its ghosts live, so dense cells only pay for the space they cover.
+//
+// A scene must be created with configure() for its regions to be set.
+class cell_broadphase : public physx::PxBroadPhaseCallback {
+public:
+    // Regions per side of the grid, which spans the up axis
+    static constexpr physx::PxU32 SUBDIVISIONS = 4;
+    static constexpr physx::PxU32 UP_AXIS = 1;
+
+    explicit cell_broadphase(float ghost_margin);
+
+    // Sets the broadphase of a scene about to be created
+    void configure(physx::PxSceneDesc &desc);
+    // Replaces the scene's regions if the cell's bounds have changed. The scene must not be
+    // stepping. Returns whether the regions were rebuilt.
+    bool update(physx::PxScene &scene, const physx::PxBounds3 &cell_bounds);
+    broadphase_stats get_stats(const physx::PxScene &scene) const;
+
+    void onObjectOutOfBounds(physx::PxShape &shape, physx::PxActor &actor) override;
+    void onObjectOutOfBounds(physx::PxAggregate &aggregate) override;
+
+private:
+    // Logs the first object out of bounds, as a sign that the ghost margin is too small
+    void count_out_of_bounds();
+
+    float ghost_margin;
+    physx::PxBounds3 bounds = physx::PxBounds3::empty();
+    std::vector<physx::PxU32> handles;
+    uint64_t out_of_bounds = 0;
+    uint64_t rebuilds = 0;
+};
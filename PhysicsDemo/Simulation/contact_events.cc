@@ -0,0 +1,71 @@
+#include "contact_events.hh"
+
+namespace {
+
+// Contact points examined per pair. Pairs with more are summarised from the first ones.
+constexpr physx::PxU32 MAX_CONTACT_POINTS = 16;
+
+}
+
+contact_event_buffer::contact_event_buffer(const size_t _capacity) : capacity(_capacity) {
+    events.reserve(capacity);
+}
+
+void contact_event_buffer::onContact(const physx::PxContactPairHeader &header, const physx::PxContactPair *pairs, const physx::PxU32 count) {
+    // Either actor may have been deleted since the contact was found
+    if (header.flags & (physx::PxContactPairHeaderFlag::eREMOVED_ACTOR_0 | physx::PxContactPairHeaderFlag::eREMOVED_ACTOR_1)) {
+        return;
+    }
+
+    for (physx::PxU32 i = 0; i < count; ++i) {
+        const physx::PxContactPair &pair = pairs[i];
+        if (!(pair.events & physx::PxPairFlag::eNOTIFY_TOUCH_FOUND)) { continue; }
+
+        for (const physx::PxActor *actor : { header.actors[0], header.actors[1] }) {
+            if (c_physx *body = get_actor_body(*actor)) {
+                body->touched = true;
+            }
+        }
+
+        ++total;
+        if (events.size() >= capacity) {
+            ++dropped;
+            continue;
+        }
+
+        physx::PxContactPairPoint points[MAX_CONTACT_POINTS];
+        const physx::PxU32 num_points = pair.extractContacts(points, MAX_CONTACT_POINTS);
+        physx::PxVec3 centre(0.0f);
+        float impulse = 0.0f;
+        if (num_points > 0) {
+            for (physx::PxU32 p = 0; p < num_points; ++p) {
+                centre += points[p].position;
+                impulse += points[p].impulse.magnitude();
+            }
+            centre /= static_cast<float>(num_points);
+        } else {
+            centre = (header.actors[0]->getGlobalPose().p + header.actors[1]->getGlobalPose().p) * 0.5f;
+        }
+
+        events.push_back(contact_event{
+            get_actor_entity(*header.actors[0]), get_actor_entity(*header.actors[1]),
+            impulse, vec3f(centre.x, centre.y, centre.z)});
+    }
+}
+
+const std::vector<contact_event> &contact_event_buffer::get_events() const {
+    return events;
+}
+
+uint64_t contact_event_buffer::get_dropped() const {
+    return dropped;
+}
+
+uint64_t contact_event_buffer::get_total() const {
+    return total;
+}
+
+void contact_event_buffer::clear() {
+    events.clear();
+    dropped = 0;
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <aether/common/vector.hh>
+
+#include <PxPhysicsAPI.h>
+
+#include "physx_body.hh"
+
+// A contact between two actors, as reported by PhysX
+struct contact_event {
+    // The entities of the two actors, or NO_ENTITY
+    uint64_t entity0;
+    uint64_t entity1;
+    // Total impulse over the contact points, zero if the scene does not report points
+    float impulse;
+    // Centre of the contact points, or of the two actors if there are none
+    vec3f point;
+};
+
+// Collects the contacts PhysX reports during fetchResults into storage allocated up
+// front. The callback does no I/O or map lookups, since it runs inside the simulation
+// step. It marks the two bodies touched through their actors' userData, which is current
+// while fetchResults runs, and contact_event_system handles the events afterwards.
+// Each cell has its own buffer, registered as its scene's simulation event callback.
+class contact_event_buffer final : public physx::PxSimulationEventCallback {
+public:
+    static constexpr size_t DEFAULT_CAPACITY = 4096;
+
+    explicit contact_event_buffer(size_t capacity = DEFAULT_CAPACITY);
+
+    void onContact(const physx::PxContactPairHeader &header, const physx::PxContactPair *pairs, physx::PxU32 count) override;
+    void onConstraintBreak(physx::PxConstraintInfo *, physx::PxU32) override {}
+    void onWake(physx::PxActor **, physx::PxU32) override {}
+    void onSleep(physx::PxActor **, physx::PxU32) override {}
+    void onTrigger(physx::PxTriggerPair *, physx::PxU32) override {}
+    void onAdvance(const physx::PxRigidBody *const *, const physx::PxTransform *, const physx::PxU32) override {}
+
+    const std::vector<contact_event> &get_events() const;
+    // Contacts that did not fit since the last clear()
+    uint64_t get_dropped() const;
+    // Contacts recorded since the buffer was created, including dropped ones
+    uint64_t get_total() const;
+    void clear();
+
+private:
+    std::vector<contact_event> events;
+    size_t capacity;
+    uint64_t dropped = 0;
+    uint64_t total = 0;
+};
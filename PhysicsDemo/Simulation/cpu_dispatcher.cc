@@ -0,0 +1,146 @@
+#include "cpu_dispatcher.hh"
+
+#include <algorithm>
+
+namespace {
+
+// The pool and queue of the pool thread running on this thread, if any
+thread_local const task_pool *current_pool = nullptr;
+thread_local uint32_t current_queue = 0;
+
+}
+
+task_pool &task_pool::get(const uint32_t num_threads) {
+    static task_pool pool(std::max(1u, num_threads));
+    return pool;
+}
+
+task_pool::task_pool(const uint32_t num_threads) {
+    for (uint32_t i = 0; i < num_threads; ++i) {
+        queues.push_back(std::make_unique<worker_queue>());
+    }
+    for (uint32_t i = 0; i < num_threads; ++i) {
+        threads.emplace_back([this, i]() { run(i); });
+    }
+}
+
+task_pool::~task_pool() {
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
+
+void task_pool::submit(physx::PxBaseTask &task, const task_priority priority) {
+    const uint32_t index = current_pool == this
+        ? current_queue
+        : next_queue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+
+    // Counted before it is queued, so that the count never goes negative when another
+    // thread takes the task straight away
+    pending.fetch_add(1);
+    {
+        std::lock_guard<std::mutex> lock(queues[index]->mutex);
+        queues[index]->tasks[static_cast<size_t>(priority)].push_back(&task);
+    }
+    {
+        // Taking the lock orders the count above before any sleeping thread's check
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+    }
+    wake.notify_one();
+}
+
+physx::PxBaseTask *task_pool::take(const uint32_t index) {
+    for (size_t priority = 0; priority < NUM_PRIORITIES; ++priority) {
+        {
+            worker_queue &own = *queues[index];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            auto &tasks = own.tasks[priority];
+            if (!tasks.empty()) {
+                physx::PxBaseTask *task = tasks.back();
+                tasks.pop_back();
+                return task;
+            }
+        }
+        for (size_t offset = 1; offset < queues.size(); ++offset) {
+            worker_queue &victim = *queues[(index + offset) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            auto &tasks = victim.tasks[priority];
+            if (!tasks.empty()) {
+                physx::PxBaseTask *task = tasks.front();
+                tasks.pop_front();
+                steals.fetch_add(1, std::memory_order_relaxed);
+                return task;
+            }
+        }
+    }
+    return nullptr;
+}
+
+void task_pool::run(const uint32_t index) {
+    current_pool = this;
+    current_queue = index;
+    while (true) {
+        if (physx::PxBaseTask *task = take(index)) {
+            pending.fetch_sub(1);
+            task->run();
+            task->release();
+            executed.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        wake.wait(lock, [this]() { return stopping || pending.load() > 0; });
+        if (stopping && pending.load() <= 0) {
+            return;
+        }
+    }
+}
+
+uint32_t task_pool::get_worker_count() const {
+    return static_cast<uint32_t>(threads.size());
+}
+
+size_t task_pool::get_queue_depth() const {
+    return static_cast<size_t>(std::max<int64_t>(0, pending.load()));
+}
+
+uint64_t task_pool::get_steals() const {
+    return steals.load(std::memory_order_relaxed);
+}
+
+uint64_t task_pool::get_executed() const {
+    return executed.load(std::memory_order_relaxed);
+}
+
+cell_cpu_dispatcher::cell_cpu_dispatcher(task_pool &_pool, const task_priority _priority) : pool(_pool), priority(_priority) {
+}
+
+void cell_cpu_dispatcher::submitTask(physx::PxBaseTask &task) {
+    submitted.fetch_add(1, std::memory_order_relaxed);
+    pool.submit(task, priority.load(std::memory_order_relaxed));
+}
+
+physx::PxU32 cell_cpu_dispatcher::getWorkerCount() const {
+    return pool.get_worker_count();
+}
+
+void cell_cpu_dispatcher::set_priority(const task_priority _priority) {
+    priority.store(_priority, std::memory_order_relaxed);
+}
+
+task_priority cell_cpu_dispatcher::get_priority() const {
+    return priority.load(std::memory_order_relaxed);
+}
+
+uint64_t cell_cpu_dispatcher::get_submitted() const {
+    return submitted.load(std::memory_order_relaxed);
+}
+
+task_pool &cell_cpu_dispatcher::get_pool() const {
+    return pool;
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <PxPhysicsAPI.h>
+
+// Order in which queued PhysX tasks are run. Within a priority, tasks are run newest
+// first on the thread that queued them and oldest first when stolen.
+enum class task_priority : uint32_t {
+    high = 0,
+    normal = 1,
+    low = 2,
+};
+
+// A work-stealing thread pool shared by the PhysX scenes of every cell in the process,
+// so that they neither wait for each other's simulation nor each run threads of their
+// own. Each worker is a process with its own pool, so workers on the same host share its
+// cores by sizing their pools to a share of them.
+//
+// Each pool thread has a queue per priority. Tasks submitted by a pool thread, which are
+// the continuations PhysX spawns within a step, go to that thread's queue. Tasks
+// submitted from outside, which start a step, are spread round-robin. An idle thread
+// takes the highest priority task available, from its own queue if it has one and
+// otherwise from another thread's.
+class task_pool {
+public:
+    static constexpr size_t NUM_PRIORITIES = 3;
+
+    // The pool shared by all cells in this process, created with num_threads by the first call
+    static task_pool &get(uint32_t num_threads);
+
+    explicit task_pool(uint32_t num_threads);
+    ~task_pool();
+
+    void submit(physx::PxBaseTask &task, task_priority priority);
+
+    uint32_t get_worker_count() const;
+    // Tasks waiting to run
+    size_t get_queue_depth() const;
+    // Tasks taken from another thread's queue since the pool was created
+    uint64_t get_steals() const;
+    // Tasks run since the pool was created
+    uint64_t get_executed() const;
+
+private:
+    struct worker_queue {
+        std::mutex mutex;
+        std::deque<physx::PxBaseTask*> tasks[NUM_PRIORITIES];
+    };
+
+    std::vector<std::unique_ptr<worker_queue>> queues;
+    std::vector<std::thread> threads;
+    std::atomic<int64_t> pending{0};
+    std::atomic<uint64_t> steals{0};
+    std::atomic<uint64_t> executed{0};
+    std::atomic<uint32_t> next_queue{0};
+
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    void run(uint32_t index);
+    physx::PxBaseTask *take(uint32_t index);
+};
+
+// The CPU dispatcher of one cell's scene. It queues the scene's tasks on a shared
+// task_pool at the cell's priority, which can be changed between steps.
+class cell_cpu_dispatcher final : public physx::PxCpuDispatcher {
+public:
+    explicit cell_cpu_dispatcher(task_pool &pool, task_priority priority = task_priority::normal);
+
+    void submitTask(physx::PxBaseTask &task) override;
+    physx::PxU32 getWorkerCount() const override;
+
+    void set_priority(task_priority priority);
+    task_priority get_priority() const;
+    // Tasks this cell has submitted since the dispatcher was created
+    uint64_t get_submitted() const;
+    task_pool &get_pool() const;
+
+private:
+    task_pool &pool;
+    std::atomic<task_priority> priority;
+    std::atomic<uint64_t> submitted{0};
+};
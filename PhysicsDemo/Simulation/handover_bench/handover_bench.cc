@@ -0,0 +1,383 @@
+// Benchmarks the handover of PhysX bodies between cells under churn. Every round a batch
+// of bodies crosses between two cells, in alternate directions, as when many bodies sit
+// on a cell border. Two codecs are compared:
+//
+//  collection  each body is a PxCollection of its actor with an exclusive shape and
+//              material, serialised to binary with PxSerialization, as the aether SDK's
+//              physx_c hands bodies over
+//  record      c_physx's fixed-layout body_record with a shape id, recreating actors
+//              from the receiving cell's body_pool
+//
+// Bytes per handover and serialisation and deserialisation times are written as JSON.
+//
+// Usage: handover_bench [--bodies N] [--rounds R] [--sleeping-fraction F] [--seed S]
+//                       [--output FILE]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <PxPhysicsAPI.h>
+
+#include "physx_body.hh"
+#include "physx_shapes.hh"
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+// The demo's cubes
+constexpr float HALF_EXTENT = 1.0f;
+constexpr float DENSITY = 10.0f;
+
+struct bench_config {
+    size_t bodies = 1000;
+    size_t rounds = 50;
+    double sleeping_fraction = 0.25;
+    uint64_t seed = 1;
+    std::string output;
+};
+
+struct codec_result {
+    std::string name;
+    uint64_t handovers = 0;
+    uint64_t bytes = 0;
+    double serialize_ns = 0.0;
+    double deserialize_ns = 0.0;
+    uint64_t actors_created = 0;
+    uint64_t actors_reused = 0;
+};
+
+struct body_params {
+    physx::PxTransform pose;
+    physx::PxVec3 linear_velocity;
+    physx::PxVec3 angular_velocity;
+    bool sleeping;
+};
+
+double elapsed_ns(const clock_type::time_point &start, const clock_type::time_point &end) {
+    return std::chrono::duration<double, std::nano>(end - start).count();
+}
+
+float uniform(std::mt19937_64 &rng, const float lo, const float hi) {
+    return std::uniform_real_distribution<float>(lo, hi)(rng);
+}
+
+std::vector<body_params> make_bodies(const bench_config &config) {
+    std::mt19937_64 rng(config.seed);
+    std::vector<body_params> bodies(config.bodies);
+    for (auto &body : bodies) {
+        const physx::PxVec3 axis = physx::PxVec3(uniform(rng, -1, 1), uniform(rng, -1, 1), uniform(rng, -1, 1)).getNormalized();
+        body.pose = physx::PxTransform(
+            physx::PxVec3(uniform(rng, -100, 100), uniform(rng, -100, 100), uniform(rng, -100, 100)),
+            physx::PxQuat(uniform(rng, 0.0f, 6.28f), axis.isZero() ? physx::PxVec3(0, 1, 0) : axis));
+        body.linear_velocity = physx::PxVec3(uniform(rng, -20, 20), uniform(rng, -20, 20), uniform(rng, -20, 20));
+        body.angular_velocity = physx::PxVec3(uniform(rng, -2, 2), uniform(rng, -2, 2), uniform(rng, -2, 2));
+        body.sleeping = std::uniform_real_distribution<double>(0.0, 1.0)(rng) < config.sleeping_fraction;
+    }
+    return bodies;
+}
+
+// PhysX with two scenes, one per cell
+class physx_world {
+private:
+    physx::PxDefaultAllocator allocator;
+    physx::PxDefaultErrorCallback errors;
+
+public:
+    physx::PxFoundation *foundation = nullptr;
+    physx::PxPhysics *physics = nullptr;
+    physx::PxDefaultCpuDispatcher *dispatcher = nullptr;
+    physx::PxSerializationRegistry *registry = nullptr;
+    physx::PxScene *scenes[2] = {nullptr, nullptr};
+
+    physx_world() {
+        foundation = PxCreateFoundation(PX_PHYSICS_VERSION, allocator, errors);
+        physics = foundation != nullptr ? PxCreatePhysics(PX_PHYSICS_VERSION, *foundation, physx::PxTolerancesScale()) : nullptr;
+        if (physics == nullptr) {
+            fprintf(stderr, "Failed to initialise PhysX\n");
+            abort();
+        }
+        registry = physx::PxSerialization::createSerializationRegistry(*physics);
+        dispatcher = physx::PxDefaultCpuDispatcherCreate(1);
+        for (auto &scene : scenes) {
+            physx::PxSceneDesc desc(physics->getTolerancesScale());
+            desc.gravity = physx::PxVec3(0.0f);
+            desc.cpuDispatcher = dispatcher;
+            desc.filterShader = physx::PxDefaultSimulationFilterShader;
+            scene = physics->createScene(desc);
+        }
+    }
+
+    ~physx_world() {
+        for (auto &scene : scenes) {
+            scene->release();
+        }
+        dispatcher->release();
+        registry->release();
+        physics->release();
+        foundation->release();
+    }
+};
+
+// The serde interface of aether's writer_serializer and reader_deserializer, over memory
+struct byte_writer {
+    std::vector<uint8_t> bytes;
+
+    void visit_bytes(const void *data, const size_t count) {
+        const auto *begin = static_cast<const uint8_t*>(data);
+        bytes.insert(bytes.end(), begin, begin + count);
+    }
+};
+
+struct byte_reader {
+    const std::vector<uint8_t> &bytes;
+    size_t offset = 0;
+
+    void visit_bytes(void *data, const size_t count) {
+        std::memcpy(data, bytes.data() + offset, count);
+        offset += count;
+    }
+};
+
+void set_motion(physx::PxRigidDynamic &actor, const body_params &params) {
+    actor.setLinearVelocity(params.linear_velocity);
+    actor.setAngularVelocity(params.angular_velocity);
+    if (params.sleeping) {
+        actor.putToSleep();
+    }
+}
+
+struct collection_body {
+    physx::PxRigidDynamic *actor = nullptr;
+    // Set once the body has been deserialised. The objects live in memory until released.
+    physx::PxCollection *collection = nullptr;
+    void *memory = nullptr;
+};
+
+void release_collection_body(collection_body &body) {
+    if (body.collection != nullptr) {
+        physx::PxCollectionExt::releaseObjects(*body.collection);
+        body.collection->release();
+        free(body.memory);
+    } else {
+        body.actor->release();
+    }
+    body = collection_body{};
+}
+
+codec_result bench_collection(const bench_config &config, const std::vector<body_params> &params, physx_world &world) {
+    codec_result result;
+    result.name = "collection";
+
+    std::vector<collection_body> bodies(params.size());
+    for (size_t i = 0; i < params.size(); ++i) {
+        // PxCollection serialisation needs the shape and material of each body to be its own
+        physx::PxMaterial *material = world.physics->createMaterial(0.0f, 0.0f, 1.0f);
+        physx::PxShape *shape = world.physics->createShape(physx::PxBoxGeometry(physx::PxVec3(HALF_EXTENT)), *material, true);
+        bodies[i].actor = world.physics->createRigidDynamic(params[i].pose);
+        bodies[i].actor->attachShape(*shape);
+        physx::PxRigidBodyExt::updateMassAndInertia(*bodies[i].actor, DENSITY);
+        world.scenes[0]->addActor(*bodies[i].actor);
+        set_motion(*bodies[i].actor, params[i]);
+        shape->release();
+        material->release();
+        ++result.actors_created;
+    }
+
+    for (size_t round = 0; round < config.rounds; ++round) {
+        physx::PxScene &to = *world.scenes[(round + 1) % 2];
+        for (auto &body : bodies) {
+            const auto start = clock_type::now();
+            physx::PxCollection *out = PxCreateCollection();
+            out->add(*body.actor);
+            physx::PxSerialization::complete(*out, *world.registry);
+            physx::PxDefaultMemoryOutputStream stream;
+            physx::PxSerialization::serializeCollectionToBinary(stream, *out, *world.registry);
+            out->release();
+            const auto serialized = clock_type::now();
+
+            // Binary collections are deserialised in place, from aligned memory that must
+            // outlive the objects
+            const size_t size = (stream.getSize() + PX_SERIAL_FILE_ALIGN - 1) / PX_SERIAL_FILE_ALIGN * PX_SERIAL_FILE_ALIGN;
+            void *memory = aligned_alloc(PX_SERIAL_FILE_ALIGN, size);
+            std::memcpy(memory, stream.getData(), stream.getSize());
+            const auto received = clock_type::now();
+            physx::PxCollection *in = physx::PxSerialization::createCollectionFromBinary(memory, *world.registry);
+            physx::PxRigidDynamic *actor = nullptr;
+            for (physx::PxU32 i = 0; i < in->getNbObjects() && actor == nullptr; ++i) {
+                actor = in->getObject(i).is<physx::PxRigidDynamic>();
+            }
+            to.addActor(*actor);
+            const auto deserialized = clock_type::now();
+
+            result.bytes += stream.getSize();
+            result.serialize_ns += elapsed_ns(start, serialized);
+            result.deserialize_ns += elapsed_ns(received, deserialized);
+            ++result.handovers;
+            ++result.actors_created;
+
+            release_collection_body(body);
+            body.actor = actor;
+            body.collection = in;
+            body.memory = memory;
+        }
+    }
+
+    for (auto &body : bodies) {
+        release_collection_body(body);
+    }
+    return result;
+}
+
+codec_result bench_record(const bench_config &config, const std::vector<body_params> &params, physx_world &world) {
+    codec_result result;
+    result.name = "record";
+
+    std::unique_ptr<shape_registry> shapes[2];
+    std::unique_ptr<body_pool> pools[2];
+    for (size_t cell = 0; cell < 2; ++cell) {
+        shapes[cell] = std::make_unique<shape_registry>(*world.physics);
+        pools[cell] = std::make_unique<body_pool>(*world.physics, *world.scenes[cell], *shapes[cell]);
+    }
+
+    std::vector<c_physx> bodies(params.size());
+    const uint32_t shape_id = shapes[0]->intern(shape_desc::box(HALF_EXTENT, 0.0f, 0.0f, 1.0f));
+    for (size_t i = 0; i < params.size(); ++i) {
+        bodies[i].actor = pools[0]->acquire(shape_id, params[i].pose);
+        bodies[i].shape_id = shape_id;
+        bodies[i].pool = pools[0].get();
+        physx::PxRigidBodyExt::updateMassAndInertia(*bodies[i].actor, DENSITY);
+        set_motion(*bodies[i].actor, params[i]);
+    }
+
+    for (size_t round = 0; round < config.rounds; ++round) {
+        body_pool &to = *pools[(round + 1) % 2];
+
+        // The batch is one handover stream, so each shape is defined once in it
+        const auto start = clock_type::now();
+        shape_stream_writer writer_shapes;
+        byte_writer writer;
+        writer.bytes.reserve(bodies.size() * sizeof(body_record));
+        for (auto &body : bodies) {
+            prepare_body_handover(body, writer_shapes);
+            body.serde_save(writer);
+        }
+        const auto serialized = clock_type::now();
+
+        shape_stream_reader reader_shapes;
+        byte_reader reader{writer.bytes};
+        std::vector<c_physx> received(bodies.size());
+        for (auto &body : received) {
+            body.serde_load(reader);
+            if (!create_handed_over_body(body, to, reader_shapes)) {
+                fprintf(stderr, "Body with undefined shape %u\n", body.record.shape_id);
+                abort();
+            }
+        }
+        const auto deserialized = clock_type::now();
+
+        result.bytes += writer.bytes.size();
+        result.serialize_ns += elapsed_ns(start, serialized);
+        result.deserialize_ns += elapsed_ns(serialized, deserialized);
+        result.handovers += bodies.size();
+
+        // The bodies that left return their actors to the sending cell's pool
+        bodies = std::move(received);
+    }
+
+    bodies.clear();
+    for (const auto &pool : pools) {
+        result.actors_created += pool->get_created();
+        result.actors_reused += pool->get_reused();
+    }
+    return result;
+}
+
+void write_json(FILE *out, const bench_config &config, const std::vector<codec_result> &results) {
+    fprintf(out, "{\n  \"config\": {\"bodies\": %zu, \"rounds\": %zu, \"sleeping_fraction\": %g, \"seed\": %llu},\n",
+        config.bodies, config.rounds, config.sleeping_fraction, static_cast<unsigned long long>(config.seed));
+    fprintf(out, "  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); ++i) {
+        const auto &r = results[i];
+        const double handovers = r.handovers == 0 ? 1.0 : static_cast<double>(r.handovers);
+        fprintf(out, "    {\"name\": \"%s\", \"handovers\": %llu, \"bytes_per_handover\": %.1f, "
+            "\"serialize_ns_per_handover\": %.1f, \"deserialize_ns_per_handover\": %.1f, "
+            "\"actors_created\": %llu, \"actors_reused\": %llu}%s\n",
+            r.name.c_str(), static_cast<unsigned long long>(r.handovers), r.bytes / handovers,
+            r.serialize_ns / handovers, r.deserialize_ns / handovers,
+            static_cast<unsigned long long>(r.actors_created), static_cast<unsigned long long>(r.actors_reused),
+            i + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+bool parse_args(int argc, const char *const *argv, bench_config &config) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const auto next = [&]() -> const char * {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Missing value for %s\n", arg.c_str());
+                exit(EXIT_FAILURE);
+            }
+            return argv[++i];
+        };
+        if (arg == "--bodies") {
+            config.bodies = std::strtoull(next(), nullptr, 10);
+        } else if (arg == "--rounds") {
+            config.rounds = std::strtoull(next(), nullptr, 10);
+        } else if (arg == "--sleeping-fraction") {
+            config.sleeping_fraction = std::strtod(next(), nullptr);
+        } else if (arg == "--seed") {
+            config.seed = std::strtoull(next(), nullptr, 10);
+        } else if (arg == "--output") {
+            config.output = next();
+        } else {
+            fprintf(stderr, "Usage: %s [--bodies N] [--rounds R] [--sleeping-fraction F] [--seed S] "
+                "[--output FILE]\n", argv[0]);
+            return false;
+        }
+    }
+    return config.bodies > 0;
+}
+
+}
+
+int main(int argc, const char *const *argv) {
+    bench_config config;
+    if (!parse_args(argc, argv, config)) {
+        return EXIT_FAILURE;
+    }
+
+    const auto params = make_bodies(config);
+    physx_world world;
+    std::vector<codec_result> results;
+    results.push_back(bench_collection(config, params, world));
+    results.push_back(bench_record(config, params, world));
+    for (const auto &r : results) {
+        const double handovers = r.handovers == 0 ? 1.0 : static_cast<double>(r.handovers);
+        fprintf(stderr, "%-12s %8.1f bytes %10.1f ns serialize %10.1f ns deserialize per handover\n",
+            r.name.c_str(), r.bytes / handovers, r.serialize_ns / handovers, r.deserialize_ns / handovers);
+    }
+
+    FILE *out = stdout;
+    if (!config.output.empty()) {
+        out = fopen(config.output.c_str(), "w");
+        if (out == nullptr) {
+            perror("fopen");
+            return EXIT_FAILURE;
+        }
+    }
+    write_json(out, config, results);
+    if (out != stdout) {
+        fclose(out);
+    }
+    return EXIT_SUCCESS;
+}
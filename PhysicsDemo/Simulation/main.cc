@@ -1,11 +1,13 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <aether/common/timer.hh>
 #include <aether/arguments.hh>
 
 #include "simulate.hh"
+#include "scenario.hh"
 #include <aether/cell_state.hh>
 #include <aether/octree_params.hh>
 #include <aether/manager.hh>
@@ -17,6 +19,29 @@
 namespace timer = aether::timer;
 using millis = std::chrono::duration<float, std::milli>;
 
+// Takes --workers-per-host N out of the arguments, before the rest go to Aether. Each worker
+// is a process with its own PhysX task pool, which gets this share of its host's cores.
+static bool workers_per_host_parse(int &argc, char *argv[], uint32_t &workers_per_host) {
+    int kept = 1;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--workers-per-host") != 0) {
+            argv[kept++] = argv[i];
+            continue;
+        }
+        char *end = nullptr;
+        const unsigned long value = i + 1 < argc ? strtoul(argv[i + 1], &end, 10) : 0;
+        if (end == nullptr || *end != '\0' || value == 0 || value > UINT32_MAX) {
+            fprintf(stderr, "--workers-per-host needs a positive number of workers\n");
+            return false;
+        }
+        workers_per_host = static_cast<uint32_t>(value);
+        ++i;
+    }
+    argc = kept;
+    argv[argc] = nullptr;
+    return true;
+}
+
 int main(int argc, char *argv[]) {
     hadean::init();
     const char *process_name = "AE_Manager";
@@ -35,7 +60,23 @@ int main(int argc, char *argv[]) {
     arguments.realtime = true;
     // how large the initial cell is in morton code terms - the side length of a cell is = 2^cell_level, volume = (2^dimension)^cell_level
     arguments.cell_level = 6;
+    // The world the simulation starts with, from the --scenario-* options, which are taken
+    // out before the rest go to Aether
+    scenario_config scenario;
+    if (!scenario_parse(argc, argv, scenario)) {
+        scenario_usage(stderr);
+        return EXIT_FAILURE;
+    }
+    // Unless told otherwise, the initial workers are assumed to share one host
+    uint32_t workers_per_host = 0;
+    if (!workers_per_host_parse(argc, argv, workers_per_host)) {
+        return EXIT_FAILURE;
+    }
     argument_parse(argc, argv, &arguments);
+    simulation_settings settings;
+    settings.scenario = scenario;
+    settings.ticks_per_second = static_cast<float>(arguments.tickrate);
+    settings.workers_per_host = workers_per_host != 0 ? workers_per_host : static_cast<uint32_t>(arguments.workers);
 
     auto static_args = arguments.to_octree_params<octree_traits>();
     static_args.feature_flags = OPTIMISE_AABBS | FAST_MODE | PHASE_BARRIERS;
@@ -48,15 +89,18 @@ int main(int argc, char *argv[]) {
     // ================================================================================================================
     // we also define some functions for determining entity state - 
     // agent_aabb - this determines the size of an entity for Aether - the larger this is the further away an entity is
-    // visible in neighbouring cells, in this case it is a cube 2.0f on each side.
+    // visible in neighbouring cells, in this case the bounds of its box swept by its velocity (get_agent_bounds).
     // agent_centre - this determines the centre of an entity for Aether - the centre determines when ownership of an
     // entity is handed over to a neighbouring cell. If this centre coordinate is outside the agent_aabb then the 
     // behaviour of aether is undefined and entities may despawn
-    static_args.build_user_state = [](const aether_cell_state<octree_traits> &aether_state) -> std::unique_ptr<user_state<octree_traits>> {
+    // The settings are captured, since the cells are run by workers that do not run main.
+    static_args.build_user_state = [settings](const aether_cell_state<octree_traits> &aether_state) -> std::unique_ptr<user_state<octree_traits>> {
         using user_state_type = entity_store_wrapper<entity_store_traits<octree_traits>>;
         user_state_type::params_type params{};
 
-        params.initialise_cell = &initialise_cell;
+        params.initialise_cell = [settings](const aether_cell_state<octree_traits> &aether_state, user_cell_state &state) {
+            initialise_cell(aether_state, state, settings);
+        };
         params.deinitialise_cell = &deinitialise_cell;
         params.serialize_to_client = &cell_state_serialize;
         params.initialise_world = &initialise_world;
@@ -64,12 +108,10 @@ int main(int argc, char *argv[]) {
         params.handle_events = &handle_events;
 
         params.agent_aabb = [](const auto &aether_state, const user_cell_state& state, user_cell_state::agent_reference agent) -> auto {
-            physx::PxBounds3 b = agent.get_dynamic<c_physx>()->actor->getWorldBounds();
-            physx::PxVec3 p = agent.get_dynamic<c_physx>()->actor->getGlobalPose().p;
-            const auto rnd = 1.0f;
+            const physx::PxBounds3 b = get_agent_bounds(state, *agent.get_dynamic<c_physx>());
             return aether::morton::AABB<morton_code<3, 21>>{
-                morton_3_encode(vec3f{p.x - rnd, p.y - rnd, p.z - rnd}),
-                morton_3_encode(vec3f{p.x + rnd, p.y + rnd, p.z + rnd}),
+                morton_3_encode(vec3f{b.minimum.x, b.minimum.y, b.minimum.z}),
+                morton_3_encode(vec3f{b.maximum.x, b.maximum.y, b.maximum.z}),
             };
         };
 
@@ -0,0 +1,218 @@
+#include "physx_body.hh"
+
+namespace {
+
+void store(float (&out)[3], const physx::PxVec3 &v) {
+    out[0] = v.x;
+    out[1] = v.y;
+    out[2] = v.z;
+}
+
+void store(float (&out)[4], const physx::PxQuat &q) {
+    out[0] = q.x;
+    out[1] = q.y;
+    out[2] = q.z;
+    out[3] = q.w;
+}
+
+physx::PxVec3 load_vec3(const float (&in)[3]) {
+    return physx::PxVec3(in[0], in[1], in[2]);
+}
+
+physx::PxQuat load_quat(const float (&in)[4]) {
+    return physx::PxQuat(in[0], in[1], in[2], in[3]);
+}
+
+}
+
+body_pool::body_pool(physx::PxPhysics &_physics, physx::PxScene &_scene, shape_registry &_shapes) :
+    physics(_physics), scene(_scene), shapes(_shapes) {
+}
+
+body_pool::~body_pool() {
+    for (auto &entry : pending) {
+        entry.first->release();
+    }
+    for (auto &actors : free_actors) {
+        for (physx::PxRigidDynamic *actor : actors) {
+            actor->release();
+        }
+    }
+}
+
+physx::PxRigidDynamic *body_pool::acquire(const uint32_t shape_id, const physx::PxTransform &pose) {
+    physx::PxRigidDynamic *actor = nullptr;
+    if (shape_id < free_actors.size() && !free_actors[shape_id].empty()) {
+        actor = free_actors[shape_id].back();
+        free_actors[shape_id].pop_back();
+        --num_free;
+        ++reused;
+        actor->setGlobalPose(pose);
+        actor->setLinearVelocity(physx::PxVec3(0.0f));
+        actor->setAngularVelocity(physx::PxVec3(0.0f));
+    } else {
+        actor = physics.createRigidDynamic(pose);
+        actor->attachShape(shapes.get_shape(shape_id));
+        ++created;
+    }
+    scene.addActor(*actor);
+    return actor;
+}
+
+void body_pool::release(physx::PxRigidDynamic &actor, const uint32_t shape_id) {
+    // The actor no longer belongs to an entity, whatever the running step reports
+    actor.userData = nullptr;
+    if (stepping) {
+        pending.emplace_back(&actor, shape_id);
+    } else {
+        put_back(actor, shape_id);
+    }
+}
+
+void body_pool::begin_step() {
+    stepping = true;
+}
+
+void body_pool::end_step() {
+    stepping = false;
+    for (auto &entry : pending) {
+        put_back(*entry.first, entry.second);
+    }
+    pending.clear();
+}
+
+void body_pool::put_back(physx::PxRigidDynamic &actor, const uint32_t shape_id) {
+    if (shape_id >= free_actors.size()) {
+        free_actors.resize(shape_id + 1);
+    }
+    if (free_actors[shape_id].size() >= MAX_FREE_PER_SHAPE) {
+        actor.release();
+        return;
+    }
+    scene.removeActor(actor);
+    free_actors[shape_id].push_back(&actor);
+    ++num_free;
+}
+
+shape_registry &body_pool::get_shapes() const {
+    return shapes;
+}
+
+uint64_t body_pool::get_created() const {
+    return created;
+}
+
+uint64_t body_pool::get_reused() const {
+    return reused;
+}
+
+size_t body_pool::get_free() const {
+    return num_free;
+}
+
+c_physx::c_physx(c_physx &&other) noexcept :
+    actor(std::exchange(other.actor, nullptr)), shape_id(other.shape_id), pool(other.pool),
+    entity_id(other.entity_id), touched(other.touched), record(other.record), shape(other.shape) {
+    if (actor != nullptr) {
+        actor->userData = this;
+    }
+}
+
+c_physx &c_physx::operator=(c_physx &&other) noexcept {
+    if (this != &other) {
+        if (actor != nullptr) {
+            pool->release(*actor, shape_id);
+        }
+        actor = std::exchange(other.actor, nullptr);
+        shape_id = other.shape_id;
+        pool = other.pool;
+        entity_id = other.entity_id;
+        touched = other.touched;
+        record = other.record;
+        shape = other.shape;
+        if (actor != nullptr) {
+            actor->userData = this;
+        }
+    }
+    return *this;
+}
+
+c_physx::~c_physx() {
+    if (actor != nullptr) {
+        pool->release(*actor, shape_id);
+    }
+}
+
+void c_physx::set_entity(const uint64_t id) {
+    entity_id = id;
+    if (actor != nullptr) {
+        actor->userData = this;
+    }
+}
+
+void c_physx::capture_record() {
+    const uint8_t send_shape = record.flags & body_record::HAS_SHAPE_DESC;
+    record = body_record{};
+    record.shape_id = shape_id;
+    record.flags = send_shape | (touched ? body_record::TOUCHED : 0);
+    if (send_shape != 0) {
+        shape = pool->get_shapes().get_desc(shape_id);
+    }
+    if (actor == nullptr) {
+        return;
+    }
+
+    const physx::PxTransform pose = actor->getGlobalPose();
+    const physx::PxTransform mass_pose = actor->getCMassLocalPose();
+    store(record.position, pose.p);
+    store(record.rotation, pose.q);
+    store(record.linear_velocity, actor->getLinearVelocity());
+    store(record.angular_velocity, actor->getAngularVelocity());
+    record.mass = actor->getMass();
+    store(record.inertia, actor->getMassSpaceInertiaTensor());
+    store(record.mass_position, mass_pose.p);
+    store(record.mass_rotation, mass_pose.q);
+    if (actor->getScene() != nullptr && actor->isSleeping()) {
+        record.flags |= body_record::SLEEPING;
+    } else {
+        record.wake_counter = actor->getWakeCounter();
+    }
+}
+
+void prepare_body_handover(c_physx &body, shape_stream_writer &stream) {
+    body.record.flags = stream.define(body.shape_id) ? body_record::HAS_SHAPE_DESC : 0;
+}
+
+bool create_handed_over_body(c_physx &body, body_pool &pool, shape_stream_reader &stream) {
+    const body_record &record = body.record;
+    if ((record.flags & body_record::HAS_SHAPE_DESC) != 0) {
+        stream.define(record.shape_id, pool.get_shapes().intern(body.shape));
+    }
+    const auto shape_id = stream.resolve(record.shape_id);
+    if (!shape_id) {
+        return false;
+    }
+
+    const physx::PxTransform pose(load_vec3(record.position), load_quat(record.rotation));
+    physx::PxRigidDynamic *actor = pool.acquire(shape_id.value(), pose);
+    actor->setMass(record.mass);
+    actor->setMassSpaceInertiaTensor(load_vec3(record.inertia));
+    actor->setCMassLocalPose(physx::PxTransform(load_vec3(record.mass_position), load_quat(record.mass_rotation)));
+    actor->setLinearVelocity(load_vec3(record.linear_velocity));
+    actor->setAngularVelocity(load_vec3(record.angular_velocity));
+    if ((record.flags & body_record::SLEEPING) != 0) {
+        actor->putToSleep();
+    } else {
+        actor->setWakeCounter(record.wake_counter);
+    }
+
+    if (body.actor != nullptr) {
+        pool.release(*body.actor, body.shape_id);
+    }
+    body.actor = actor;
+    body.shape_id = shape_id.value();
+    body.pool = &pool;
+    body.touched = (record.flags & body_record::TOUCHED) != 0;
+    actor->userData = &body;
+    return true;
+}
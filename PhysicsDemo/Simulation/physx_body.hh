@@ -0,0 +1,155 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <PxPhysicsAPI.h>
+
+#include "physx_shapes.hh"
+
+// The entity of an actor that belongs to none
+static constexpr uint64_t NO_ENTITY = std::numeric_limits<uint64_t>::max();
+
+// The fixed layout in which handover sends a rigid dynamic body, in the byte order of the
+// host, which is little-endian wherever the demo runs. A shape definition follows the
+// record when HAS_SHAPE_DESC is set, the first time the shape is used in a stream.
+struct body_record {
+    static constexpr uint8_t SLEEPING = 1;
+    static constexpr uint8_t HAS_SHAPE_DESC = 2;
+    static constexpr uint8_t TOUCHED = 4;
+
+    float position[3];
+    float rotation[4];
+    float linear_velocity[3];
+    float angular_velocity[3];
+    float mass;
+    float inertia[3];
+    // The centre of mass frame relative to the actor
+    float mass_position[3];
+    float mass_rotation[4];
+    float wake_counter;
+    uint32_t shape_id;
+    uint8_t flags;
+    uint8_t padding[3];
+};
+static_assert(std::is_trivially_copyable<body_record>::value, "body_record is sent as bytes");
+static_assert(sizeof(body_record) == 108, "body_record layout changed");
+static_assert(std::is_trivially_copyable<shape_desc>::value, "shape_desc is sent as bytes");
+
+// Recycles the actors of one cell's bodies. A body that leaves the cell returns its actor,
+// which is taken out of the scene and kept with its shape attached for the next body with
+// that shape, so that churn at cell borders does not create and release an actor each
+// time. Actors returned while the scene is stepping are held until end_step().
+class body_pool {
+public:
+    // Free actors kept per shape, beyond which returned actors are released
+    static constexpr size_t MAX_FREE_PER_SHAPE = 256;
+
+    body_pool(physx::PxPhysics &physics, physx::PxScene &scene, shape_registry &shapes);
+    ~body_pool();
+    body_pool(const body_pool&) = delete;
+    body_pool &operator=(const body_pool&) = delete;
+
+    // Returns an actor with the shape at pose, at rest and added to the scene
+    physx::PxRigidDynamic *acquire(uint32_t shape_id, const physx::PxTransform &pose);
+    void release(physx::PxRigidDynamic &actor, uint32_t shape_id);
+
+    void begin_step();
+    void end_step();
+
+    shape_registry &get_shapes() const;
+    // Actors created, and actors reused from the pool, since the pool was created
+    uint64_t get_created() const;
+    uint64_t get_reused() const;
+    size_t get_free() const;
+
+private:
+    physx::PxPhysics &physics;
+    physx::PxScene &scene;
+    shape_registry &shapes;
+    // Free actors by shape id
+    std::vector<std::vector<physx::PxRigidDynamic*>> free_actors;
+    std::vector<std::pair<physx::PxRigidDynamic*, uint32_t>> pending;
+    bool stepping = false;
+    uint64_t created = 0;
+    uint64_t reused = 0;
+    size_t num_free = 0;
+
+    void put_back(physx::PxRigidDynamic &actor, uint32_t shape_id);
+};
+
+// The PhysX body of an entity. This takes the place of the aether SDK's physx_c, which
+// hands bodies over as serialised PxCollections and so needs a shape and material of
+// its own for every entity. Here shapes come from the cell's shape_registry, and handover
+// sends a body_record with a shape id.
+//
+// The component owns its actor, which it returns to its cell's body_pool. The actor's
+// userData points back at the component, and is moved along with it, so that contacts
+// resolve to bodies without a lookup.
+struct c_physx {
+    physx::PxRigidDynamic *actor = nullptr;
+    uint32_t shape_id = 0;
+    body_pool *pool = nullptr;
+    // The id of the entity, or NO_ENTITY until set_entity() is called
+    uint64_t entity_id = NO_ENTITY;
+    // Whether the body has touched another since it was created. Handed over with it.
+    bool touched = false;
+
+    // What handover sends. Serialisation fills it in from the actor, and deserialisation
+    // leaves it for create_handed_over_body() to create the actor from.
+    body_record record{};
+    shape_desc shape{};
+
+    c_physx() = default;
+    c_physx(c_physx &&other) noexcept;
+    c_physx &operator=(c_physx &&other) noexcept;
+    c_physx(const c_physx&) = delete;
+    c_physx &operator=(const c_physx&) = delete;
+    ~c_physx();
+
+    // Sets the entity the body belongs to and points the actor's userData at it. Called
+    // when the entity is created and when it is deserialised in a new cell.
+    void set_entity(uint64_t id);
+
+    template<typename SD>
+    void serde_save(SD &sd) {
+        capture_record();
+        visit_record(sd);
+    }
+
+    template<typename SD>
+    void serde_load(SD &sd) {
+        visit_record(sd);
+    }
+
+private:
+    void capture_record();
+
+    template<typename SD>
+    void visit_record(SD &sd) {
+        sd.visit_bytes(&record, sizeof(record));
+        if ((record.flags & body_record::HAS_SHAPE_DESC) != 0) {
+            sd.visit_bytes(&shape, sizeof(shape));
+        }
+    }
+};
+
+// The body whose actor this is, or null for actors without one, such as the world bounds
+inline c_physx *get_actor_body(const physx::PxActor &actor) {
+    return static_cast<c_physx*>(actor.userData);
+}
+
+inline uint64_t get_actor_entity(const physx::PxActor &actor) {
+    const c_physx *body = get_actor_body(actor);
+    return body != nullptr ? body->entity_id : NO_ENTITY;
+}
+
+// Marks whether the body's shape definition is sent along with it on a handover stream
+void prepare_body_handover(c_physx &body, shape_stream_writer &stream);
+
+// Creates the actor of a deserialised body from its record, interning the shape if its
+// definition was sent. Returns false if the shape is unknown.
+bool create_handed_over_body(c_physx &body, body_pool &pool, shape_stream_reader &stream);
@@ -0,0 +1,81 @@
+#include "physx_shapes.hh"
+
+#include <cassert>
+
+shape_desc shape_desc::box(const float half_extent, const float static_friction, const float dynamic_friction, const float restitution) {
+    return shape_desc{physx::PxVec3(half_extent), static_friction, dynamic_friction, restitution};
+}
+
+bool shape_desc::operator<(const shape_desc &other) const {
+    return std::tie(half_extents.x, half_extents.y, half_extents.z, static_friction, dynamic_friction, restitution) <
+        std::tie(other.half_extents.x, other.half_extents.y, other.half_extents.z,
+            other.static_friction, other.dynamic_friction, other.restitution);
+}
+
+shape_registry::shape_registry(physx::PxPhysics &_physics) : physics(_physics) {
+}
+
+shape_registry::~shape_registry() {
+    // Bodies hold their own references, so shapes still in use outlive the registry
+    for (physx::PxShape *shape : shapes) {
+        shape->release();
+    }
+    for (const auto &entry : materials) {
+        entry.second->release();
+    }
+}
+
+uint32_t shape_registry::intern(const shape_desc &desc) {
+    const auto found = ids.find(desc);
+    if (found != ids.end()) {
+        return found->second;
+    }
+
+    physx::PxMaterial *&material = materials[std::make_tuple(desc.static_friction, desc.dynamic_friction, desc.restitution)];
+    if (material == nullptr) {
+        material = physics.createMaterial(desc.static_friction, desc.dynamic_friction, desc.restitution);
+    }
+    // Shapes that are not exclusive can be attached to any number of actors
+    physx::PxShape *shape = physics.createShape(physx::PxBoxGeometry(desc.half_extents), *material, false);
+
+    const uint32_t id = static_cast<uint32_t>(shapes.size());
+    ids.emplace(desc, id);
+    descs.push_back(desc);
+    shapes.push_back(shape);
+    return id;
+}
+
+physx::PxShape &shape_registry::get_shape(const uint32_t id) const {
+    assert(id < shapes.size());
+    return *shapes[id];
+}
+
+const shape_desc &shape_registry::get_desc(const uint32_t id) const {
+    assert(id < descs.size());
+    return descs[id];
+}
+
+size_t shape_registry::size() const {
+    return shapes.size();
+}
+
+bool shape_stream_writer::define(const uint32_t id) {
+    if (id >= defined.size()) {
+        defined.resize(id + 1, false);
+    }
+    const bool first = !defined[id];
+    defined[id] = true;
+    return first;
+}
+
+void shape_stream_reader::define(const uint32_t sender_id, const uint32_t local_id) {
+    ids[sender_id] = local_id;
+}
+
+std::optional<uint32_t> shape_stream_reader::resolve(const uint32_t sender_id) const {
+    const auto found = ids.find(sender_id);
+    if (found == ids.end()) {
+        return std::nullopt;
+    }
+    return found->second;
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include <PxPhysicsAPI.h>
+
+// The geometry and material of a body's shape. The demo only has boxes.
+struct shape_desc {
+    physx::PxVec3 half_extents;
+    float static_friction;
+    float dynamic_friction;
+    float restitution;
+
+    static shape_desc box(float half_extent, float static_friction, float dynamic_friction, float restitution);
+
+    bool operator<(const shape_desc &other) const;
+};
+
+// Interns the shapes of one cell's bodies, so that bodies with the same geometry and
+// material share a PxShape and bodies with the same material share a PxMaterial, rather
+// than each entity allocating its own. Shapes are given small dense ids, which are only
+// meaningful within the cell. The registry holds a reference to each shape and material
+// until it is destroyed, which must happen before the cell's PxPhysics is released.
+class shape_registry {
+public:
+    explicit shape_registry(physx::PxPhysics &physics);
+    ~shape_registry();
+    shape_registry(const shape_registry&) = delete;
+    shape_registry &operator=(const shape_registry&) = delete;
+
+    // Returns the id of the shape for desc, creating it if there is none yet
+    uint32_t intern(const shape_desc &desc);
+
+    physx::PxShape &get_shape(uint32_t id) const;
+    const shape_desc &get_desc(uint32_t id) const;
+    size_t size() const;
+
+private:
+    physx::PxPhysics &physics;
+    std::map<shape_desc, uint32_t> ids;
+    std::map<std::tuple<float, float, float>, physx::PxMaterial*> materials;
+    std::vector<shape_desc> descs;
+    std::vector<physx::PxShape*> shapes;
+};
+
+// Handover sends a shape's definition the first time the shape is used in a stream of
+// entities, and only its id after that. Each agent_serializer keeps one of these, and
+// the matching agent_deserializer a shape_stream_reader.
+class shape_stream_writer {
+public:
+    // Returns true if the shape has not been sent on this stream before
+    bool define(uint32_t id);
+
+private:
+    std::vector<bool> defined;
+};
+
+// Maps the sender's shape ids on one stream to ids in the receiving cell's registry
+class shape_stream_reader {
+public:
+    void define(uint32_t sender_id, uint32_t local_id);
+    std::optional<uint32_t> resolve(uint32_t sender_id) const;
+
+private:
+    std::unordered_map<uint32_t, uint32_t> ids;
+};
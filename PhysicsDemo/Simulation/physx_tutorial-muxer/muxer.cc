@@ -6,10 +6,21 @@
 
 using netcode = aether::netcode::generic_netcode<marshalling_factory>;
 
+// World units. The cubes are two units across.
+static constexpr float PREDICTION_TOLERANCE = 0.05f;
+static constexpr std::chrono::milliseconds PREDICTION_KEEPALIVE{1000};
+
 extern "C" {
 
 void *new_netcode_context() {
-    return new netcode();
+    // Entities carry their velocity, so changes that clients can extrapolate to within
+    // PREDICTION_TOLERANCE are held back, for up to PREDICTION_KEEPALIVE
+    auto policy = aether::netcode::generic_interest_policy();
+    policy.set_prediction(PREDICTION_TOLERANCE, PREDICTION_KEEPALIVE);
+    // Workers only send entities at rest every ENTITY_KEEPALIVE_TICKS
+    policy.set_entity_history(ENTITY_HISTORY_TICKS);
+    // Clients receive entities sorted by id with the ids sent as a compact column
+    return new netcode(policy, marshalling_factory(true));
 }
 
 void destroy_netcode_context(void *ctx) {
@@ -0,0 +1,419 @@
+// In-process load harness for the muxer netcode. N synthetic workers emit
+// trivial_marshaller payloads into the same generic_netcode used by muxer.cc, and M
+// fake client connections drain its output. The muxer runtime is replaced by the fake
+// connection_* functions below, so no Aether cluster is needed.
+//
+// Usage: netcode_load_harness [--workers N] [--entities-per-worker E] [--connections M]
+//                             [--ticks T] [--tick-hz HZ] [--motion static|walk|orbit]
+//                             [--bandwidth BYTES_PER_TICK] [--sorted-ids] [--seed S]
+//                             [--prediction-tolerance UNITS] [--output FILE]
+//
+// --prediction-tolerance turns on the muxer's dead reckoning. Entity colours then stay
+// fixed, as a colour change always has to be sent, so update latency is not measured.
+
+#include <aether/muxer/netcode.hh>
+#include <aether/common/base_protocol.hh>
+#include <aether/generic-netcode/generic_netcode.hh>
+#include <aether/generic-netcode/trivial_marshalling.hh>
+#include <variant>
+#include <protocol.hh>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <unistd.h>
+
+namespace {
+
+using netcode = aether::netcode::generic_netcode<marshalling_factory>;
+using harness_clock = std::chrono::steady_clock;
+
+enum class motion_type {
+    stationary,
+    random_walk,
+    orbit,
+};
+
+struct harness_config {
+    size_t workers = 4;
+    size_t entities_per_worker = 1000;
+    size_t connections = 8;
+    size_t ticks = 600;
+    double tick_hz = 60.0;
+    motion_type motion = motion_type::random_walk;
+    // Bytes each connection can drain per tick. 0 means unlimited.
+    size_t bandwidth = 0;
+    bool sorted_ids = false;
+    float prediction_tolerance = 0.0f;
+    uint64_t seed = 1;
+    std::string output;
+};
+
+// Stands in for a muxer client connection. Packets are counted and kept until the end
+// of the tick so that decoding them is not included in the netcode timings.
+struct fake_connection {
+    uint64_t player_id;
+    bool subscribed = false;
+    bool released = false;
+    size_t queued_bytes = 0;
+    size_t total_bytes = 0;
+    size_t total_packets = 0;
+    std::vector<std::vector<char>> pending;
+};
+
+struct fake_muxer {
+};
+
+struct fake_entity {
+    vec3f position;
+    vec3f velocity;
+};
+
+double percentile(std::vector<double> values, const double p) {
+    if (values.empty()) {
+        return 0.0;
+    }
+    const size_t index = std::min(values.size() - 1, static_cast<size_t>(p * values.size()));
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+size_t resident_set_bytes() {
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm == nullptr) {
+        return 0;
+    }
+    unsigned long size = 0, resident = 0;
+    const int matched = fscanf(statm, "%lu %lu", &size, &resident);
+    fclose(statm);
+    return matched == 2 ? resident * static_cast<size_t>(sysconf(_SC_PAGESIZE)) : 0;
+}
+
+double process_cpu_ms() {
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// A simulation worker that owns a fixed set of entities and moves them every tick
+class synthetic_worker {
+private:
+    uint64_t worker_id;
+    std::vector<fake_entity> entities;
+    std::mt19937_64 rng;
+    marshalling_factory factory;
+    motion_type motion;
+    bool tick_in_colour;
+
+public:
+    synthetic_worker(const uint64_t _worker_id, const harness_config &config)
+        : worker_id(_worker_id), entities(config.entities_per_worker), rng(config.seed + _worker_id),
+          factory(config.sorted_ids), motion(config.motion), tick_in_colour(config.prediction_tolerance <= 0.0f) {
+        std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+        std::uniform_real_distribution<float> velocity(-1.0f, 1.0f);
+        for (auto &entity : entities) {
+            entity.position = vec3f(position(rng), position(rng), std::fabs(position(rng)));
+            entity.velocity = vec3f(velocity(rng), velocity(rng), velocity(rng));
+        }
+    }
+
+    void step(const float dt) {
+        std::normal_distribution<float> jitter(0.0f, 0.5f);
+        for (auto &entity : entities) {
+            switch (motion) {
+                case motion_type::stationary:
+                    break;
+                case motion_type::random_walk:
+                    entity.velocity = entity.velocity + vec3f(jitter(rng), jitter(rng), jitter(rng)) * dt;
+                    entity.position = entity.position + entity.velocity * dt;
+                    break;
+                case motion_type::orbit: {
+                    // Rotate about the z axis at a rate set by the entity's velocity
+                    const float angle = entity.velocity.x * dt;
+                    const float c = std::cos(angle), s = std::sin(angle);
+                    const auto &p = entity.position;
+                    entity.position = vec3f(c * p.x - s * p.y, s * p.x + c * p.y, p.z);
+                    break;
+                }
+            }
+        }
+    }
+
+    vec3f get_velocity(const fake_entity &entity) const {
+        switch (motion) {
+            case motion_type::random_walk:
+                return entity.velocity;
+            case motion_type::orbit:
+                return vec3f(-entity.position.y, entity.position.x, 0.0f) * entity.velocity.x;
+            default:
+                return vec3f::zero();
+        }
+    }
+
+    // The payload a worker would send to the muxer for `tick`. Unless dead reckoning is
+    // on, each entity's colour carries the tick so clients can measure end-to-end latency.
+    std::vector<char> serialize(const uint64_t tick) const {
+        auto marshaller = factory.create_marshaller();
+        marshaller.reserve(entities.size());
+
+        protocol::base::client_message header{};
+        header.stats.num_agents = entities.size();
+        marshaller.add_worker_data(worker_id, header);
+
+        for (size_t i = 0; i < entities.size(); ++i) {
+            trivial_marshalling_traits::entity_type point{};
+            point.id = worker_id * 1000000 + i;
+            point.net_encoded_position = entities[i].position;
+            point.net_encoded_orientation = { 0.0f, 0.0f, 0.0f, 1.0f };
+            point.net_encoded_velocity = get_velocity(entities[i]);
+            point.net_encoded_color = tick_in_colour ? static_cast<uint32_t>(tick) : 0;
+            point.size = 1.0f;
+            marshaller.add_entity(point);
+        }
+        return marshaller.encode();
+    }
+};
+
+bool parse_args(int argc, const char *const *argv, harness_config &config) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const auto next = [&]() -> const char * {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Missing value for %s\n", arg.c_str());
+                exit(EXIT_FAILURE);
+            }
+            return argv[++i];
+        };
+        if (arg == "--workers") {
+            config.workers = std::strtoull(next(), nullptr, 10);
+        } else if (arg == "--entities-per-worker") {
+            config.entities_per_worker = std::strtoull(next(), nullptr, 10);
+        } else if (arg == "--connections") {
+            config.connections = std::strtoull(next(), nullptr, 10);
+        } else if (arg == "--ticks") {
+            config.ticks = std::strtoull(next(), nullptr, 10);
+        } else if (arg == "--tick-hz") {
+            config.tick_hz = std::strtod(next(), nullptr);
+        } else if (arg == "--bandwidth") {
+            config.bandwidth = std::strtoull(next(), nullptr, 10);
+        } else if (arg == "--sorted-ids") {
+            config.sorted_ids = true;
+        } else if (arg == "--seed") {
+            config.seed = std::strtoull(next(), nullptr, 10);
+        } else if (arg == "--prediction-tolerance") {
+            config.prediction_tolerance = std::strtof(next(), nullptr);
+        } else if (arg == "--output") {
+            config.output = next();
+        } else if (arg == "--motion") {
+            const std::string motion = next();
+            if (motion == "static") {
+                config.motion = motion_type::stationary;
+            } else if (motion == "walk") {
+                config.motion = motion_type::random_walk;
+            } else if (motion == "orbit") {
+                config.motion = motion_type::orbit;
+            } else {
+                fprintf(stderr, "Unknown motion type %s\n", motion.c_str());
+                return false;
+            }
+        } else {
+            fprintf(stderr, "Usage: %s [--workers N] [--entities-per-worker E] [--connections M] [--ticks T] "
+                "[--tick-hz HZ] [--motion static|walk|orbit] [--bandwidth BYTES_PER_TICK] [--sorted-ids] "
+                "[--seed S] [--prediction-tolerance UNITS] [--output FILE]\n", argv[0]);
+            return false;
+        }
+    }
+    return config.tick_hz > 0.0;
+}
+
+}
+
+// The muxer runtime API used by generic_netcode, implemented against fake_connection
+namespace aether {
+
+namespace netcode {
+
+void connection_push_packet(void *connection, void *muxer, uint32_t stream, const void *data, size_t length) {
+    auto *conn = static_cast<fake_connection *>(connection);
+    const auto *bytes = static_cast<const char *>(data);
+    conn->pending.emplace_back(bytes, bytes + length);
+    conn->queued_bytes += length;
+    conn->total_bytes += length;
+    ++conn->total_packets;
+}
+
+void connection_subscribe_writable(void *connection, void *muxer, bool subscribe) {
+    static_cast<fake_connection *>(connection)->subscribed = subscribe;
+}
+
+bool connection_is_drained(void *connection) {
+    return static_cast<fake_connection *>(connection)->queued_bytes == 0;
+}
+
+void connection_notify_writable(void *connection, void *muxer) {
+}
+
+void release_connection(void *connection) {
+    static_cast<fake_connection *>(connection)->released = true;
+}
+
+uint64_t connection_get_player_id(void *connection) {
+    return static_cast<fake_connection *>(connection)->player_id;
+}
+
+}
+
+}
+
+int main(int argc, const char *const *argv) {
+    harness_config config;
+    if (!parse_args(argc, argv, config)) {
+        return EXIT_FAILURE;
+    }
+
+    fake_muxer muxer;
+    auto policy = aether::netcode::generic_interest_policy();
+    policy.set_prediction(config.prediction_tolerance, std::chrono::milliseconds(1000));
+    netcode nc(policy, marshalling_factory(config.sorted_ids));
+
+    std::vector<synthetic_worker> workers;
+    for (size_t w = 0; w < config.workers; ++w) {
+        workers.emplace_back(w, config);
+    }
+
+    std::vector<fake_connection> connections(config.connections);
+    for (size_t c = 0; c < connections.size(); ++c) {
+        connections[c].player_id = c;
+        nc.new_connection(&muxer, &connections[c], c);
+    }
+
+    const auto tick_period = std::chrono::duration_cast<harness_clock::duration>(
+        std::chrono::duration<double>(1.0 / config.tick_hz));
+    const float dt = static_cast<float>(1.0 / config.tick_hz);
+    std::vector<harness_clock::time_point> tick_times;
+    tick_times.reserve(config.ticks);
+
+    std::vector<double> tick_cpu_ms, tick_wall_ms, tick_lateness_ms, latency_ms;
+    const size_t rss_start = resident_set_bytes();
+    size_t rss_peak = rss_start;
+    size_t payload_bytes = 0;
+    size_t overrun_ticks = 0;
+
+    auto demarshaller_factory = marshalling_factory();
+    const auto start = harness_clock::now();
+    auto deadline = start;
+    for (size_t tick = 0; tick < config.ticks; ++tick) {
+        std::this_thread::sleep_until(deadline);
+        const auto tick_start = harness_clock::now();
+        tick_lateness_ms.push_back(std::chrono::duration<double, std::milli>(tick_start - deadline).count());
+        tick_times.push_back(tick_start);
+
+        // Workers are separate processes in a deployment, so their cost is not timed
+        std::vector<std::vector<char>> payloads;
+        for (auto &worker : workers) {
+            worker.step(dt);
+            payloads.push_back(worker.serialize(tick));
+            payload_bytes += payloads.back().size();
+        }
+
+        const double cpu_start = process_cpu_ms();
+        const auto wall_start = harness_clock::now();
+        for (size_t w = 0; w < payloads.size(); ++w) {
+            nc.new_simulation_message(&muxer, w, tick, payloads[w].data(), payloads[w].size());
+        }
+        for (size_t c = 0; c < connections.size(); ++c) {
+            auto &conn = connections[c];
+            conn.queued_bytes = config.bandwidth == 0 ? 0 : conn.queued_bytes - std::min(conn.queued_bytes, config.bandwidth);
+            if (conn.subscribed) {
+                nc.notify_writable(&muxer, c);
+            }
+        }
+        tick_cpu_ms.push_back(process_cpu_ms() - cpu_start);
+        tick_wall_ms.push_back(std::chrono::duration<double, std::milli>(harness_clock::now() - wall_start).count());
+
+        // Clients decode what they received to measure update latency
+        const auto received = harness_clock::now();
+        for (auto &conn : connections) {
+            for (const auto &packet : conn.pending) {
+                auto demarshaller = demarshaller_factory.create_demarshaller();
+                demarshaller.decode(packet.data(), packet.size());
+                for (const auto &entity : demarshaller.get_entities()) {
+                    const uint64_t sent_tick = entity.net_encoded_color;
+                    if ((entity.flags & protocol::base::entity_flags::is_dead) == 0 && sent_tick < tick_times.size()
+                        && config.prediction_tolerance <= 0.0f) {
+                        latency_ms.push_back(std::chrono::duration<double, std::milli>(received - tick_times[sent_tick]).count());
+                    }
+                }
+            }
+            conn.pending.clear();
+        }
+
+        rss_peak = std::max(rss_peak, resident_set_bytes());
+        deadline += tick_period;
+        // If the harness can not keep up, start the next tick now rather than letting
+        // lateness accumulate
+        const auto now = harness_clock::now();
+        if (deadline < now) {
+            deadline = now;
+            ++overrun_ticks;
+        }
+    }
+    const double elapsed_s = std::chrono::duration<double>(harness_clock::now() - start).count();
+    const size_t rss_end = resident_set_bytes();
+
+    size_t client_bytes = 0, client_packets = 0;
+    for (const auto &conn : connections) {
+        client_bytes += conn.total_bytes;
+        client_packets += conn.total_packets;
+    }
+    const double num_connections = std::max<size_t>(connections.size(), 1);
+
+    FILE *out = stdout;
+    if (!config.output.empty()) {
+        out = fopen(config.output.c_str(), "w");
+        if (out == nullptr) {
+            perror("fopen");
+            return EXIT_FAILURE;
+        }
+    }
+    fprintf(out, "{\n  \"config\": {\"workers\": %zu, \"entities_per_worker\": %zu, \"connections\": %zu, "
+        "\"ticks\": %zu, \"tick_hz\": %g, \"bandwidth\": %zu, \"sorted_ids\": %s, \"seed\": %llu, "
+        "\"prediction_tolerance\": %g},\n",
+        config.workers, config.entities_per_worker, config.connections, config.ticks, config.tick_hz,
+        config.bandwidth, config.sorted_ids ? "true" : "false", static_cast<unsigned long long>(config.seed),
+        config.prediction_tolerance);
+    fprintf(out, "  \"tick_cpu_ms\": {\"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f},\n",
+        percentile(tick_cpu_ms, 0.5), percentile(tick_cpu_ms, 0.9), percentile(tick_cpu_ms, 0.99), percentile(tick_cpu_ms, 1.0));
+    fprintf(out, "  \"tick_wall_ms\": {\"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f},\n",
+        percentile(tick_wall_ms, 0.5), percentile(tick_wall_ms, 0.9), percentile(tick_wall_ms, 0.99), percentile(tick_wall_ms, 1.0));
+    fprintf(out, "  \"tick_lateness_ms\": {\"p50\": %.3f, \"p99\": %.3f, \"max\": %.3f, \"overrun_ticks\": %zu},\n",
+        percentile(tick_lateness_ms, 0.5), percentile(tick_lateness_ms, 0.99), percentile(tick_lateness_ms, 1.0),
+        overrun_ticks);
+    fprintf(out, "  \"update_latency_ms\": {\"samples\": %zu, \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f},\n",
+        latency_ms.size(), percentile(latency_ms, 0.5), percentile(latency_ms, 0.9), percentile(latency_ms, 0.99),
+        percentile(latency_ms, 1.0));
+    fprintf(out, "  \"traffic\": {\"worker_payload_bytes\": %zu, \"bytes_per_client\": %.0f, "
+        "\"bytes_per_client_per_second\": %.0f, \"packets_per_client\": %.1f},\n",
+        payload_bytes, client_bytes / num_connections, client_bytes / num_connections / elapsed_s,
+        client_packets / num_connections);
+    fprintf(out, "  \"memory\": {\"rss_start_bytes\": %zu, \"rss_end_bytes\": %zu, \"rss_peak_bytes\": %zu, "
+        "\"rss_growth_bytes\": %lld}\n}\n",
+        rss_start, rss_end, rss_peak, static_cast<long long>(rss_end) - static_cast<long long>(rss_start));
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    for (size_t c = 0; c < connections.size(); ++c) {
+        nc.drop_connection(&muxer, c);
+    }
+    return EXIT_SUCCESS;
+}
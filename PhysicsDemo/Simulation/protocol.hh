@@ -4,8 +4,16 @@
 
 struct trivial_marshalling_traits {
    using per_worker_data_type = protocol::base::client_message;
-   using entity_type = protocol::base::net_point_3d;
+   using entity_type = protocol::base::net_moving_point_3d;
    using static_data_type = std::monostate;
 };
 
 using marshalling_factory = aether::netcode::trivial_marshalling<trivial_marshalling_traits>;
+
+// Workers send the entities PhysX moved each tick, and every other entity once in this
+// many ticks. The muxer keeps entities for ENTITY_HISTORY_TICKS after their last update,
+// which covers a missed keepalive.
+static constexpr uint64_t ENTITY_KEEPALIVE_TICKS = 15;
+static constexpr uint64_t ENTITY_HISTORY_TICKS = 2 * ENTITY_KEEPALIVE_TICKS;
+static_assert(ENTITY_HISTORY_TICKS > ENTITY_KEEPALIVE_TICKS,
+    "The muxer must keep entities at rest for longer than the keepalive interval");
@@ -0,0 +1,558 @@
+// Headless swarm of client connections for load testing a muxer. Every connection is
+// driven from a single epoll loop through repclient_protocol, the framing code used by
+// repclient, and decodes what it receives with trivial_demarshaller as physx_client
+// does. Connections authenticate with consecutive player ids and can optionally send
+// scripted interaction messages. Results are written as JSON.
+//
+// Usage: repclient_swarm --host HOST --port PORT [--connections N] [--duration SECONDS]
+//                        [--connect-rate PER_SECOND] [--first-player-id ID]
+//                        [--interaction-hz HZ] [--interaction-bytes B] [--stall-ms MS]
+//                        [--receive-buffer BYTES] [--per-connection] [--output FILE]
+
+#include <aether/repclient.hh>
+#include <aether/common/base_protocol.hh>
+#include <aether/generic-netcode/trivial_marshalling.hh>
+#include <variant>
+#include <protocol.hh>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace {
+
+using swarm_clock = std::chrono::steady_clock;
+
+// Matches worker_message_type in the client
+constexpr uint8_t DEBUG_MSG = 0;
+constexpr size_t MAX_INTERACTION_TEXT = 255;
+
+struct swarm_config {
+    std::string host;
+    std::string port;
+    size_t connections = 100;
+    double duration_s = 30.0;
+    // Connection attempts started per second. 0 starts them all at once.
+    double connect_rate = 200.0;
+    uint64_t first_player_id = 1;
+    // Interaction messages each connection sends per second. 0 sends none.
+    double interaction_hz = 0.0;
+    size_t interaction_bytes = 32;
+    // A gap between messages longer than this counts as a stall
+    double stall_ms = 250.0;
+    size_t receive_buffer = 64 * 1024;
+    bool per_connection = false;
+    std::string output;
+};
+
+enum class bot_state {
+    waiting,
+    connecting,
+    open,
+    failed,
+    closed,
+};
+
+struct bot {
+    uint64_t player_id = 0;
+    int fd = -1;
+    bot_state state = bot_state::waiting;
+    bool want_write = false;
+    std::unique_ptr<repclient_protocol> protocol;
+
+    swarm_clock::time_point connected_at {};
+    swarm_clock::time_point first_message {};
+    swarm_clock::time_point last_message {};
+    swarm_clock::time_point next_interaction {};
+    swarm_clock::time_point closed_at {};
+
+    size_t bytes_received = 0;
+    size_t messages = 0;
+    size_t entities = 0;
+    size_t decode_failures = 0;
+    double decode_ms = 0.0;
+    size_t stalls = 0;
+    double stalled_ms = 0.0;
+    double max_gap_ms = 0.0;
+    size_t interactions_sent = 0;
+    size_t interactions_dropped = 0;
+    size_t interaction_seq = 0;
+};
+
+volatile std::sig_atomic_t interrupted = 0;
+
+void on_interrupt(int) {
+    interrupted = 1;
+}
+
+double percentile(std::vector<double> values, const double p) {
+    if (values.empty()) {
+        return 0.0;
+    }
+    const size_t index = std::min(values.size() - 1, static_cast<size_t>(p * values.size()));
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+double process_cpu_ms() {
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+double ms_between(const swarm_clock::time_point &start, const swarm_clock::time_point &end) {
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+bool parse_args(int argc, const char *const *argv, swarm_config &config) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const auto next = [&]() -> const char * {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Missing value for %s\n", arg.c_str());
+                exit(EXIT_FAILURE);
+            }
+            return argv[++i];
+        };
+        if (arg == "--host") {
+            config.host = next();
+        } else if (arg == "--port") {
+            config.port = next();
+        } else if (arg == "--connections") {
+            config.connections = std::strtoull(next(), nullptr, 10);
+        } else if (arg == "--duration") {
+            config.duration_s = std::strtod(next(), nullptr);
+        } else if (arg == "--connect-rate") {
+            config.connect_rate = std::strtod(next(), nullptr);
+        } else if (arg == "--first-player-id") {
+            config.first_player_id = std::strtoull(next(), nullptr, 10);
+        } else if (arg == "--interaction-hz") {
+            config.interaction_hz = std::strtod(next(), nullptr);
+        } else if (arg == "--interaction-bytes") {
+            config.interaction_bytes = std::strtoull(next(), nullptr, 10);
+        } else if (arg == "--stall-ms") {
+            config.stall_ms = std::strtod(next(), nullptr);
+        } else if (arg == "--receive-buffer") {
+            config.receive_buffer = std::strtoull(next(), nullptr, 10);
+        } else if (arg == "--per-connection") {
+            config.per_connection = true;
+        } else if (arg == "--output") {
+            config.output = next();
+        } else {
+            fprintf(stderr, "Usage: %s --host HOST --port PORT [--connections N] [--duration SECONDS] "
+                "[--connect-rate PER_SECOND] [--first-player-id ID] [--interaction-hz HZ] "
+                "[--interaction-bytes B] [--stall-ms MS] [--receive-buffer BYTES] [--per-connection] "
+                "[--output FILE]\n", argv[0]);
+            return false;
+        }
+    }
+    if (config.host.empty() || config.port.empty()) {
+        fprintf(stderr, "--host and --port are required\n");
+        return false;
+    }
+    if (config.receive_buffer == 0 || (config.receive_buffer & (config.receive_buffer - 1)) != 0) {
+        fprintf(stderr, "--receive-buffer must be a power of two\n");
+        return false;
+    }
+    config.interaction_bytes = std::clamp<size_t>(config.interaction_bytes, 2, 2 + MAX_INTERACTION_TEXT);
+    return config.duration_s > 0.0;
+}
+
+class swarm {
+private:
+    const swarm_config &config;
+    addrinfo *address = nullptr;
+    int epoll_fd = -1;
+    std::vector<bot> bots;
+    marshalling_factory factory;
+    std::vector<double> decode_us;
+    size_t next_to_connect = 0;
+    swarm_clock::time_point start;
+
+    void close_bot(bot &b, const bot_state state) {
+        if (b.fd >= 0) {
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, b.fd, nullptr);
+            close(b.fd);
+            b.fd = -1;
+        }
+        b.state = state;
+        b.closed_at = swarm_clock::now();
+    }
+
+    void update_events(bot &b, const bool want_write) {
+        if (b.want_write == want_write && b.state != bot_state::connecting) { return; }
+        b.want_write = want_write;
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLRDHUP | (want_write ? uint32_t{EPOLLOUT} : 0u);
+        event.data.u64 = &b - bots.data();
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, b.fd, &event);
+    }
+
+    void start_connect(bot &b) {
+        b.fd = socket(address->ai_family, address->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, address->ai_protocol);
+        if (b.fd < 0) {
+            perror("socket");
+            b.state = bot_state::failed;
+            return;
+        }
+        const int one = 1;
+        setsockopt(b.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (connect(b.fd, address->ai_addr, address->ai_addrlen) != 0 && errno != EINPROGRESS) {
+            close_bot(b, bot_state::failed);
+            return;
+        }
+        epoll_event event{};
+        event.events = EPOLLOUT;
+        event.data.u64 = &b - bots.data();
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, b.fd, &event) != 0) {
+            perror("epoll_ctl");
+            abort();
+        }
+        b.state = bot_state::connecting;
+    }
+
+    void finish_connect(bot &b) {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        if (getsockopt(b.fd, SOL_SOCKET, SO_ERROR, &error, &length) != 0 || error != 0) {
+            close_bot(b, bot_state::failed);
+            return;
+        }
+        b.connected_at = swarm_clock::now();
+        b.next_interaction = b.connected_at;
+        b.protocol = std::make_unique<repclient_protocol>(config.receive_buffer);
+        b.protocol->try_authenticate_player_id(b.player_id);
+        update_events(b, false);
+        b.state = bot_state::open;
+        flush(b);
+    }
+
+    // Sends from both halves of the send buffer, and waits for the socket to become
+    // writable again if not all of it could be sent
+    void flush(bot &b) {
+        auto &send_buffer = b.protocol->get_send_buffer();
+        while (!send_buffer.is_empty()) {
+            const auto first = send_buffer.get_head();
+            const auto second = send_buffer.get_from_offset(first.size());
+            std::array<iovec, 2> iov;
+            iov[0].iov_base = const_cast<char *>(first.data());
+            iov[0].iov_len = first.size();
+            iov[1].iov_base = const_cast<char *>(second.data());
+            iov[1].iov_len = second.size();
+            msghdr msg{};
+            msg.msg_iov = iov.data();
+            msg.msg_iovlen = second.empty() ? 1 : 2;
+            const ssize_t written = sendmsg(b.fd, &msg, MSG_NOSIGNAL);
+            if (written >= 0) {
+                send_buffer.move_head(written);
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            } else if (errno != EINTR) {
+                close_bot(b, bot_state::closed);
+                return;
+            }
+        }
+        update_events(b, !send_buffer.is_empty());
+    }
+
+    void record_message(bot &b, const void *const data, const size_t length) {
+        const auto now = swarm_clock::now();
+        if (b.messages == 0) {
+            b.first_message = now;
+        } else {
+            const double gap_ms = ms_between(b.last_message, now);
+            b.max_gap_ms = std::max(b.max_gap_ms, gap_ms);
+            if (gap_ms > config.stall_ms) {
+                ++b.stalls;
+                b.stalled_ms += gap_ms;
+            }
+        }
+        b.last_message = now;
+        ++b.messages;
+
+        const auto decode_start = swarm_clock::now();
+        auto demarshaller = factory.create_demarshaller();
+        if (demarshaller.decode(data, length)) {
+            b.entities += demarshaller.get_entities().size();
+        } else {
+            ++b.decode_failures;
+        }
+        const double elapsed_ms = ms_between(decode_start, swarm_clock::now());
+        b.decode_ms += elapsed_ms;
+        decode_us.push_back(elapsed_ms * 1e3);
+    }
+
+    // The socket is level triggered, so anything left unread is reported again
+    void receive(bot &b) {
+        auto &receive_buffer = b.protocol->get_receive_buffer();
+        if (receive_buffer.has_space()) {
+            const auto regions = receive_buffer.get_unallocated_regions();
+            std::array<iovec, 2> iov;
+            for (size_t i = 0; i < iov.size(); ++i) {
+                iov[i].iov_base = regions[i].data();
+                iov[i].iov_len = regions[i].size();
+            }
+            const ssize_t bytes_read = readv(b.fd, iov.data(), regions[1].empty() ? 1 : 2);
+            if (bytes_read > 0) {
+                receive_buffer.move_tail(bytes_read);
+                b.bytes_received += bytes_read;
+            } else if (bytes_read == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                close_bot(b, bot_state::closed);
+                return;
+            }
+        }
+
+        // This thread is both the producer and the consumer of the receive buffer
+        repclient_protocol::stream_id worker_id;
+        uint64_t length;
+        while (const void *const message = b.protocol->tick(&worker_id, &length)) {
+            record_message(b, message, length);
+        }
+    }
+
+    void send_interactions(const swarm_clock::time_point now) {
+        if (config.interaction_hz <= 0.0) { return; }
+        const auto period = std::chrono::duration_cast<swarm_clock::duration>(
+            std::chrono::duration<double>(1.0 / config.interaction_hz));
+        std::array<char, 2 + MAX_INTERACTION_TEXT> message;
+        for (auto &b : bots) {
+            if (b.state != bot_state::open || now < b.next_interaction) { continue; }
+            const size_t text_length = config.interaction_bytes - 2;
+            message[0] = static_cast<char>(DEBUG_MSG);
+            message[1] = static_cast<char>(text_length);
+            std::fill(message.begin() + 2, message.begin() + 2 + text_length, ' ');
+            char text[64];
+            const int n = snprintf(text, sizeof(text), "swarm player %llu interaction %zu",
+                static_cast<unsigned long long>(b.player_id), b.interaction_seq++);
+            std::memcpy(&message[2], text, std::min<size_t>(std::max(n, 0), text_length));
+            if (b.protocol->try_send(message.data(), config.interaction_bytes)) {
+                ++b.interactions_sent;
+            } else {
+                ++b.interactions_dropped;
+            }
+            // Stay on the original schedule, but do not try to catch up on missed sends
+            b.next_interaction = std::max(b.next_interaction + period, now);
+            flush(b);
+        }
+    }
+
+    swarm_clock::time_point next_connect_time() const {
+        if (config.connect_rate <= 0.0) { return start; }
+        return start + std::chrono::duration_cast<swarm_clock::duration>(
+            std::chrono::duration<double>(next_to_connect / config.connect_rate));
+    }
+
+public:
+    explicit swarm(const swarm_config &_config) : config(_config), bots(_config.connections) {
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        const int ret = getaddrinfo(config.host.c_str(), config.port.c_str(), &hints, &address);
+        if (ret != 0) {
+            fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(ret));
+            exit(EXIT_FAILURE);
+        }
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd < 0) {
+            perror("epoll_create1");
+            abort();
+        }
+        for (size_t i = 0; i < bots.size(); ++i) {
+            bots[i].player_id = config.first_player_id + i;
+        }
+    }
+
+    swarm(const swarm &) = delete;
+    swarm &operator=(const swarm &) = delete;
+
+    ~swarm() {
+        for (auto &b : bots) {
+            if (b.fd >= 0) { close(b.fd); }
+        }
+        close(epoll_fd);
+        freeaddrinfo(address);
+    }
+
+    double run() {
+        start = swarm_clock::now();
+        const auto end = start + std::chrono::duration_cast<swarm_clock::duration>(
+            std::chrono::duration<double>(config.duration_s));
+        std::vector<epoll_event> events(std::max<size_t>(bots.size(), 1));
+        while (!interrupted) {
+            auto now = swarm_clock::now();
+            if (now >= end) { break; }
+            while (next_to_connect < bots.size() && next_connect_time() <= now) {
+                start_connect(bots[next_to_connect++]);
+            }
+            send_interactions(now);
+
+            // Wake for the next connection attempt or interaction, and at least every
+            // 100ms to check for the end of the run
+            auto wake = std::min(end, now + std::chrono::milliseconds(100));
+            if (next_to_connect < bots.size()) {
+                wake = std::min(wake, next_connect_time());
+            }
+            if (config.interaction_hz > 0.0) {
+                wake = std::min(wake, now + std::chrono::duration_cast<swarm_clock::duration>(
+                    std::chrono::duration<double>(1.0 / config.interaction_hz)));
+            }
+            const auto timeout = std::chrono::ceil<std::chrono::milliseconds>(wake - now);
+            const int num_events = epoll_wait(epoll_fd, events.data(), events.size(),
+                static_cast<int>(std::max<int64_t>(timeout.count(), 0)));
+            if (num_events < 0) {
+                if (errno == EINTR) { continue; }
+                perror("epoll_wait");
+                abort();
+            }
+            for (int i = 0; i < num_events; ++i) {
+                auto &b = bots[events[i].data.u64];
+                if (b.state == bot_state::connecting) {
+                    finish_connect(b);
+                    continue;
+                }
+                if (b.state != bot_state::open) { continue; }
+                if ((events[i].events & EPOLLOUT) != 0) {
+                    flush(b);
+                }
+                if ((events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) != 0) {
+                    receive(b);
+                }
+            }
+        }
+        return std::chrono::duration<double>(swarm_clock::now() - start).count();
+    }
+
+    void report(FILE *const out, const double elapsed_s, const double cpu_ms) const {
+        const auto now = swarm_clock::now();
+        size_t opened = 0, failed = 0, closed = 0, never_started = 0, never_received = 0;
+        size_t bytes = 0, messages = 0, entities = 0, decode_failures = 0, stalls = 0;
+        size_t interactions_sent = 0, interactions_dropped = 0, stalled_connections = 0;
+        double decode_ms = 0.0;
+        std::vector<double> throughput, max_gap, time_to_first_ms;
+        for (const auto &b : bots) {
+            switch (b.state) {
+                case bot_state::waiting: ++never_started; break;
+                case bot_state::failed: ++failed; break;
+                case bot_state::closed: ++closed; break;
+                default: break;
+            }
+            if (b.connected_at == swarm_clock::time_point{}) { continue; }
+            ++opened;
+            bytes += b.bytes_received;
+            messages += b.messages;
+            entities += b.entities;
+            decode_failures += b.decode_failures;
+            decode_ms += b.decode_ms;
+            interactions_sent += b.interactions_sent;
+            interactions_dropped += b.interactions_dropped;
+
+            const auto connection_end = b.state == bot_state::closed ? b.closed_at : now;
+            // The time since the last message counts as a stall if the run ends during one
+            const double trailing_gap_ms = b.messages > 0 ? ms_between(b.last_message, connection_end) : 0.0;
+            const size_t bot_stalls = b.stalls + (trailing_gap_ms > config.stall_ms ? 1 : 0);
+            stalls += bot_stalls;
+            stalled_connections += bot_stalls > 0 ? 1 : 0;
+            max_gap.push_back(std::max(b.max_gap_ms, trailing_gap_ms));
+            throughput.push_back(b.bytes_received / std::max(1e-9, ms_between(b.connected_at, connection_end) / 1e3));
+            if (b.messages > 0) {
+                time_to_first_ms.push_back(ms_between(b.connected_at, b.first_message));
+            } else {
+                ++never_received;
+            }
+        }
+
+        fprintf(out, "{\n  \"config\": {\"host\": \"%s\", \"port\": \"%s\", \"connections\": %zu, \"duration_s\": %g, "
+            "\"connect_rate\": %g, \"first_player_id\": %llu, \"interaction_hz\": %g, \"interaction_bytes\": %zu, "
+            "\"stall_ms\": %g, \"receive_buffer\": %zu},\n",
+            config.host.c_str(), config.port.c_str(), config.connections, config.duration_s, config.connect_rate,
+            static_cast<unsigned long long>(config.first_player_id), config.interaction_hz, config.interaction_bytes,
+            config.stall_ms, config.receive_buffer);
+        fprintf(out, "  \"connections\": {\"opened\": %zu, \"failed\": %zu, \"closed_by_peer\": %zu, "
+            "\"not_started\": %zu, \"never_received\": %zu},\n",
+            opened, failed, closed, never_started, never_received);
+        fprintf(out, "  \"traffic\": {\"elapsed_s\": %.3f, \"bytes\": %zu, \"messages\": %zu, \"entities\": %zu, "
+            "\"bytes_per_second\": %.0f, \"messages_per_second\": %.1f},\n",
+            elapsed_s, bytes, messages, entities, bytes / elapsed_s, messages / elapsed_s);
+        fprintf(out, "  \"connection_bytes_per_second\": {\"min\": %.0f, \"p10\": %.0f, \"p50\": %.0f, \"max\": %.0f},\n",
+            percentile(throughput, 0.0), percentile(throughput, 0.1), percentile(throughput, 0.5),
+            percentile(throughput, 1.0));
+        fprintf(out, "  \"time_to_first_message_ms\": {\"p50\": %.3f, \"p99\": %.3f, \"max\": %.3f},\n",
+            percentile(time_to_first_ms, 0.5), percentile(time_to_first_ms, 0.99), percentile(time_to_first_ms, 1.0));
+        fprintf(out, "  \"decode_us\": {\"samples\": %zu, \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f, "
+            "\"failures\": %zu, \"total_ms\": %.3f},\n",
+            decode_us.size(), percentile(decode_us, 0.5), percentile(decode_us, 0.9), percentile(decode_us, 0.99),
+            percentile(decode_us, 1.0), decode_failures, decode_ms);
+        fprintf(out, "  \"stalls\": {\"count\": %zu, \"connections\": %zu, \"max_gap_ms_p50\": %.3f, "
+            "\"max_gap_ms_p99\": %.3f, \"max_gap_ms_max\": %.3f},\n",
+            stalls, stalled_connections, percentile(max_gap, 0.5), percentile(max_gap, 0.99), percentile(max_gap, 1.0));
+        fprintf(out, "  \"interactions\": {\"sent\": %zu, \"dropped\": %zu},\n", interactions_sent, interactions_dropped);
+        fprintf(out, "  \"cpu\": {\"process_ms\": %.3f, \"utilisation\": %.3f}%s\n",
+            cpu_ms, cpu_ms / 1e3 / elapsed_s, config.per_connection ? "," : "");
+
+        if (config.per_connection) {
+            fprintf(out, "  \"per_connection\": [\n");
+            for (size_t i = 0; i < bots.size(); ++i) {
+                const auto &b = bots[i];
+                static const char *const state_names[] = { "waiting", "connecting", "open", "failed", "closed" };
+                fprintf(out, "    {\"player_id\": %llu, \"state\": \"%s\", \"bytes\": %zu, \"messages\": %zu, "
+                    "\"entities\": %zu, \"decode_ms\": %.3f, \"decode_failures\": %zu, \"stalls\": %zu, "
+                    "\"stalled_ms\": %.3f, \"max_gap_ms\": %.3f, \"interactions_sent\": %zu, "
+                    "\"interactions_dropped\": %zu}%s\n",
+                    static_cast<unsigned long long>(b.player_id), state_names[static_cast<int>(b.state)],
+                    b.bytes_received, b.messages, b.entities, b.decode_ms, b.decode_failures, b.stalls,
+                    b.stalled_ms, b.max_gap_ms, b.interactions_sent, b.interactions_dropped,
+                    i + 1 < bots.size() ? "," : "");
+            }
+            fprintf(out, "  ]\n");
+        }
+        fprintf(out, "}\n");
+    }
+};
+
+}
+
+int main(int argc, const char *const *argv) {
+    swarm_config config;
+    if (!parse_args(argc, argv, config)) {
+        return EXIT_FAILURE;
+    }
+    std::signal(SIGINT, on_interrupt);
+    std::signal(SIGTERM, on_interrupt);
+
+    swarm s(config);
+    const double cpu_start = process_cpu_ms();
+    const double elapsed_s = s.run();
+    const double cpu_ms = process_cpu_ms() - cpu_start;
+
+    FILE *out = stdout;
+    if (!config.output.empty()) {
+        out = fopen(config.output.c_str(), "w");
+        if (out == nullptr) {
+            perror("fopen");
+            return EXIT_FAILURE;
+        }
+    }
+    s.report(out, elapsed_s, cpu_ms);
+    if (out != stdout) {
+        fclose(out);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,395 @@
+#include "scenario.hh"
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+namespace {
+
+// Bodies generated by each thread at least, below which threads cost more than they save
+constexpr uint64_t MIN_BODIES_PER_THREAD = 4096;
+
+// Streams of random numbers, so that cluster centres and bodies with the same index differ
+constexpr uint64_t BODY_STREAM = 1;
+constexpr uint64_t CLUSTER_STREAM = 2;
+
+// Fixed point scale of the weights of log-uniform sizes
+constexpr uint64_t LOG_UNIFORM_WEIGHT_SCALE = 1ull << 32;
+
+uint64_t splitmix64(uint64_t &state) {
+    uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+// A generator defined here rather than by the standard library, whose engines and
+// distributions may give different numbers in different builds
+class scenario_rng {
+public:
+    scenario_rng(const uint64_t seed, const uint64_t stream, const uint64_t index) : state(seed) {
+        state = splitmix64(state) ^ stream;
+        state = splitmix64(state) ^ index;
+    }
+
+    uint64_t next() {
+        return splitmix64(state);
+    }
+
+    // In [0, 1)
+    float next_float() {
+        return static_cast<float>(next() >> 40) * (1.0f / 16777216.0f);
+    }
+
+    float next_float(const float lo, const float hi) {
+        return lo + (hi - lo) * next_float();
+    }
+
+    // Approximately standard normal, as a sum of uniforms so that it needs no libm
+    float next_normal() {
+        float sum = 0.0f;
+        for (int i = 0; i < 12; ++i) {
+            sum += next_float();
+        }
+        return sum - 6.0f;
+    }
+
+private:
+    uint64_t state;
+};
+
+physx::PxVec3 cluster_centre(const scenario_config &config, const uint32_t cluster) {
+    scenario_rng rng(config.seed, CLUSTER_STREAM, cluster);
+    const float x = rng.next_float(-config.extent, config.extent);
+    const float y = rng.next_float(-config.extent, config.extent);
+    const float z = rng.next_float(-config.extent, config.extent);
+    return physx::PxVec3(x, y, z);
+}
+
+uint64_t size_quanta(const float size) {
+    return static_cast<uint64_t>(std::max(1.0f, std::round(size / SIZE_QUANTUM)));
+}
+
+// Cumulative weights of the quantised sizes from size_min to size_max for a log-uniform
+// distribution, whose density is proportional to 1 / size. They are integers so that the
+// sizes drawn do not depend on how a build's libm rounds.
+std::vector<uint64_t> log_uniform_size_weights(const scenario_config &config) {
+    std::vector<uint64_t> cumulative;
+    if (config.sizes != size_distribution::log_uniform) {
+        return cumulative;
+    }
+    uint64_t total = 0;
+    for (uint64_t quanta = size_quanta(config.size_min); quanta <= size_quanta(config.size_max); ++quanta) {
+        total += LOG_UNIFORM_WEIGHT_SCALE / quanta;
+        cumulative.push_back(total);
+    }
+    return cumulative;
+}
+
+float generate_size(const scenario_config &config, const std::vector<uint64_t> &size_weights, scenario_rng &rng) {
+    float size = config.size_min;
+    switch (config.sizes) {
+    case size_distribution::fixed:
+        break;
+    case size_distribution::uniform:
+        size = rng.next_float(config.size_min, config.size_max);
+        break;
+    case size_distribution::log_uniform: {
+        const uint64_t draw = rng.next() % size_weights.back();
+        const auto index = std::upper_bound(size_weights.begin(), size_weights.end(), draw) - size_weights.begin();
+        return static_cast<float>(size_quanta(config.size_min) + index) * SIZE_QUANTUM;
+    }
+    }
+    return std::max(SIZE_QUANTUM, std::round(size / SIZE_QUANTUM) * SIZE_QUANTUM);
+}
+
+physx::PxVec3 generate_position(const scenario_config &config, const std::vector<physx::PxVec3> &centres,
+                                const uint64_t id, scenario_rng &rng) {
+    switch (config.layout) {
+    case spatial_distribution::uniform:
+        break;
+    case spatial_distribution::clustered: {
+        const physx::PxVec3 &centre = centres[rng.next() % centres.size()];
+        const float x = rng.next_normal();
+        const float y = rng.next_normal();
+        const float z = rng.next_normal();
+        return centre + physx::PxVec3(x, y, z) * config.cluster_radius;
+    }
+    case spatial_distribution::pileup: {
+        uint64_t side = 1;
+        while (side * side * side < config.bodies) {
+            ++side;
+        }
+        // Room for the largest body, and a little more so that they start apart
+        const float spacing = 2.0f * config.size_max * 1.05f;
+        const float offset = 0.5f * static_cast<float>(side - 1);
+        return physx::PxVec3(
+            (static_cast<float>(id % side) - offset) * spacing,
+            (static_cast<float>(id / side % side) - offset) * spacing,
+            (static_cast<float>(id / (side * side)) - offset) * spacing);
+    }
+    }
+    const float x = rng.next_float(-config.extent, config.extent);
+    const float y = rng.next_float(-config.extent, config.extent);
+    const float z = rng.next_float(-config.extent, config.extent);
+    return physx::PxVec3(x, y, z);
+}
+
+scenario_body generate_body(const scenario_config &config, const std::vector<physx::PxVec3> &centres,
+                            const std::vector<uint64_t> &size_weights, const uint64_t id) {
+    scenario_rng rng(config.seed, BODY_STREAM, id);
+    scenario_body body;
+    body.id = id;
+    body.size = generate_size(config, size_weights, rng);
+    body.position = generate_position(config, centres, id, rng);
+    // Inside the world's walls
+    const float limit = WORLD_HALF_EXTENT - body.size;
+    body.position.x = std::clamp(body.position.x, -limit, limit);
+    body.position.y = std::clamp(body.position.y, -limit, limit);
+    body.position.z = std::clamp(body.position.z, -limit, limit);
+    const float vx = rng.next_float(-config.max_velocity.x, config.max_velocity.x);
+    const float vy = rng.next_float(-config.max_velocity.y, config.max_velocity.y);
+    const float vz = rng.next_float(-config.max_velocity.z, config.max_velocity.z);
+    body.velocity = physx::PxVec3(vx, vy, vz);
+    return body;
+}
+
+bool parse_u64(const char *value, uint64_t &out) {
+    char *end = nullptr;
+    errno = 0;
+    const unsigned long long parsed = strtoull(value, &end, 10);
+    if (errno != 0 || end == value || *end != '\0') {
+        return false;
+    }
+    out = parsed;
+    return true;
+}
+
+bool parse_float(const char *value, float &out) {
+    char *end = nullptr;
+    errno = 0;
+    const float parsed = strtof(value, &end);
+    if (errno != 0 || end == value || *end != '\0' || !std::isfinite(parsed)) {
+        return false;
+    }
+    out = parsed;
+    return true;
+}
+
+bool parse_vec3(const char *value, physx::PxVec3 &out) {
+    char *end = nullptr;
+    float v[3];
+    const char *next = value;
+    for (int axis = 0; axis < 3; ++axis) {
+        v[axis] = strtof(next, &end);
+        if (end == next || !std::isfinite(v[axis]) || *end != (axis < 2 ? ',' : '\0')) {
+            return false;
+        }
+        next = end + 1;
+    }
+    out = physx::PxVec3(v[0], v[1], v[2]);
+    return true;
+}
+
+bool parse_option(const char *option, const char *value, scenario_config &config) {
+    if (strcmp(option, "--scenario-bodies") == 0) {
+        return parse_u64(value, config.bodies);
+    } else if (strcmp(option, "--scenario-seed") == 0) {
+        return parse_u64(value, config.seed);
+    } else if (strcmp(option, "--scenario-layout") == 0) {
+        if (strcmp(value, "uniform") == 0) {
+            config.layout = spatial_distribution::uniform;
+        } else if (strcmp(value, "clustered") == 0) {
+            config.layout = spatial_distribution::clustered;
+        } else if (strcmp(value, "pileup") == 0) {
+            config.layout = spatial_distribution::pileup;
+        } else {
+            return false;
+        }
+        return true;
+    } else if (strcmp(option, "--scenario-extent") == 0) {
+        return parse_float(value, config.extent) && config.extent > 0.0f;
+    } else if (strcmp(option, "--scenario-clusters") == 0) {
+        uint64_t clusters = 0;
+        if (!parse_u64(value, clusters) || clusters == 0 || clusters > UINT32_MAX) {
+            return false;
+        }
+        config.clusters = static_cast<uint32_t>(clusters);
+        return true;
+    } else if (strcmp(option, "--scenario-cluster-radius") == 0) {
+        return parse_float(value, config.cluster_radius) && config.cluster_radius >= 0.0f;
+    } else if (strcmp(option, "--scenario-sizes") == 0) {
+        if (strcmp(value, "fixed") == 0) {
+            config.sizes = size_distribution::fixed;
+        } else if (strcmp(value, "uniform") == 0) {
+            config.sizes = size_distribution::uniform;
+        } else if (strcmp(value, "log-uniform") == 0) {
+            config.sizes = size_distribution::log_uniform;
+        } else {
+            return false;
+        }
+        return true;
+    } else if (strcmp(option, "--scenario-size-min") == 0) {
+        return parse_float(value, config.size_min);
+    } else if (strcmp(option, "--scenario-size-max") == 0) {
+        return parse_float(value, config.size_max);
+    } else if (strcmp(option, "--scenario-velocity") == 0) {
+        return parse_vec3(value, config.max_velocity);
+    } else if (strcmp(option, "--scenario-density") == 0) {
+        return parse_float(value, config.density) && config.density > 0.0f;
+    } else if (strcmp(option, "--scenario-manifest") == 0) {
+        config.manifest = value;
+        return true;
+    }
+    fprintf(stderr, "Unknown option %s\n", option);
+    return false;
+}
+
+const char *layout_name(const spatial_distribution layout) {
+    switch (layout) {
+    case spatial_distribution::uniform: return "uniform";
+    case spatial_distribution::clustered: return "clustered";
+    case spatial_distribution::pileup: return "pileup";
+    }
+    return "unknown";
+}
+
+const char *sizes_name(const size_distribution sizes) {
+    switch (sizes) {
+    case size_distribution::fixed: return "fixed";
+    case size_distribution::uniform: return "uniform";
+    case size_distribution::log_uniform: return "log-uniform";
+    }
+    return "unknown";
+}
+
+}
+
+void scenario_usage(FILE *out) {
+    fprintf(out,
+        "Scenario options:\n"
+        "  --scenario-bodies N               bodies in the world (10)\n"
+        "  --scenario-seed S                 seed of the world (1)\n"
+        "  --scenario-layout L               uniform, clustered or pileup (uniform)\n"
+        "  --scenario-extent F               half the side of the cube bodies are placed in (100)\n"
+        "  --scenario-clusters N             clusters of a clustered layout (8)\n"
+        "  --scenario-cluster-radius F       standard deviation of a cluster (10)\n"
+        "  --scenario-sizes D                fixed, uniform or log-uniform (fixed)\n"
+        "  --scenario-size-min F             smallest half side of a cube (1)\n"
+        "  --scenario-size-max F             largest half side of a cube (1)\n"
+        "  --scenario-velocity X,Y,Z         largest initial speed on each axis (20,80,20)\n"
+        "  --scenario-density F              density of the bodies (10)\n"
+        "  --scenario-manifest FILE          where to write the manifest of the world\n");
+}
+
+bool scenario_parse(int &argc, char *argv[], scenario_config &config) {
+    int kept = 1;
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "--scenario-", strlen("--scenario-")) != 0) {
+            argv[kept++] = argv[i];
+            continue;
+        }
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Missing value for %s\n", argv[i]);
+            return false;
+        }
+        if (!parse_option(argv[i], argv[i + 1], config)) {
+            fprintf(stderr, "Invalid value %s for %s\n", argv[i + 1], argv[i]);
+            return false;
+        }
+        ++i;
+    }
+    argc = kept;
+    argv[argc] = nullptr;
+
+    if (config.sizes == size_distribution::fixed) {
+        config.size_max = config.size_min;
+    }
+    if (config.size_min <= 0.0f || config.size_max < config.size_min || config.size_max >= WORLD_HALF_EXTENT) {
+        fprintf(stderr, "Scenario sizes must be positive and fit in the world, with --scenario-size-max no less "
+            "than --scenario-size-min\n");
+        return false;
+    }
+    return true;
+}
+
+std::vector<scenario_body> generate_scenario(const scenario_config &config) {
+    std::vector<physx::PxVec3> centres;
+    if (config.layout == spatial_distribution::clustered) {
+        for (uint32_t cluster = 0; cluster < config.clusters; ++cluster) {
+            centres.push_back(cluster_centre(config, cluster));
+        }
+    }
+
+    const std::vector<uint64_t> size_weights = log_uniform_size_weights(config);
+
+    std::vector<scenario_body> bodies(config.bodies);
+    const uint64_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+    const uint64_t num_threads = std::min(max_threads, (config.bodies + MIN_BODIES_PER_THREAD - 1) / MIN_BODIES_PER_THREAD);
+    const auto generate_range = [&](const uint64_t begin, const uint64_t end) {
+        for (uint64_t id = begin; id < end; ++id) {
+            bodies[id] = generate_body(config, centres, size_weights, id);
+        }
+    };
+    if (num_threads <= 1) {
+        generate_range(0, config.bodies);
+        return bodies;
+    }
+
+    std::vector<std::thread> threads;
+    const uint64_t per_thread = (config.bodies + num_threads - 1) / num_threads;
+    for (uint64_t begin = 0; begin < config.bodies; begin += per_thread) {
+        threads.emplace_back(generate_range, begin, std::min(config.bodies, begin + per_thread));
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    return bodies;
+}
+
+uint64_t scenario_checksum(const std::vector<scenario_body> &bodies) {
+    // FNV-1a over each field, so padding does not count
+    uint64_t hash = 0xcbf29ce484222325ull;
+    const auto add = [&hash](const void *data, const size_t size) {
+        const auto *bytes = static_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < size; ++i) {
+            hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+        }
+    };
+    for (const auto &body : bodies) {
+        const float fields[] = {body.position.x, body.position.y, body.position.z, body.size,
+                                body.velocity.x, body.velocity.y, body.velocity.z};
+        add(&body.id, sizeof(body.id));
+        add(fields, sizeof(fields));
+    }
+    return hash;
+}
+
+bool write_scenario_manifest(const std::string &path, const scenario_config &config, const float cell_size,
+                             const std::vector<scenario_batch> &batches, const uint64_t checksum) {
+    FILE *out = fopen(path.c_str(), "w");
+    if (out == nullptr) {
+        perror("fopen");
+        return false;
+    }
+    fprintf(out, "{\n  \"config\": {\"bodies\": %" PRIu64 ", \"seed\": %" PRIu64 ", \"layout\": \"%s\", "
+        "\"extent\": %g, \"clusters\": %u, \"cluster_radius\": %g, \"sizes\": \"%s\", \"size_min\": %g, "
+        "\"size_max\": %g, \"velocity\": [%g, %g, %g], \"density\": %g},\n",
+        config.bodies, config.seed, layout_name(config.layout), config.extent, config.clusters,
+        config.cluster_radius, sizes_name(config.sizes), config.size_min, config.size_max,
+        config.max_velocity.x, config.max_velocity.y, config.max_velocity.z, config.density);
+    fprintf(out, "  \"checksum\": \"%016" PRIx64 "\",\n", checksum);
+    fprintf(out, "  \"cell_size\": %g,\n  \"batches\": [\n", cell_size);
+    for (size_t i = 0; i < batches.size(); ++i) {
+        const auto &batch = batches[i];
+        fprintf(out, "    {\"cell\": [%d, %d, %d], \"bodies\": %" PRIu64 "}%s\n",
+            batch.cell[0], batch.cell[1], batch.cell[2], batch.bodies, i + 1 < batches.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+    fclose(out);
+    return true;
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <PxPhysicsAPI.h>
+
+// How initialise_world lays out the bodies of the world
+enum class spatial_distribution {
+    // Anywhere in a cube of side 2 * extent about the origin
+    uniform,
+    // Normally distributed about cluster centres, which are uniform in the cube
+    clustered,
+    // Packed in a block at the origin, as tightly as the largest body allows
+    pileup,
+};
+
+enum class size_distribution {
+    // Every body is size_min
+    fixed,
+    uniform,
+    log_uniform,
+};
+
+// The world a run starts with. The same config generates the same bodies in any build
+// and on any number of threads, so that runs under load can be repeated and compared.
+struct scenario_config {
+    uint64_t bodies = 10;
+    uint64_t seed = 1;
+    spatial_distribution layout = spatial_distribution::uniform;
+    float extent = 100.0f;
+    uint32_t clusters = 8;
+    // Standard deviation of a cluster on each axis
+    float cluster_radius = 10.0f;
+    size_distribution sizes = size_distribution::fixed;
+    // Half the side of a body's cube. Sizes are rounded to multiples of SIZE_QUANTUM, so
+    // that bodies share few enough shapes to be interned.
+    float size_min = 1.0f;
+    float size_max = 1.0f;
+    // Initial velocities are uniform within plus or minus this on each axis
+    physx::PxVec3 max_velocity = physx::PxVec3(20.0f, 80.0f, 20.0f);
+    float density = 10.0f;
+    // Where initialise_world writes the manifest, if anywhere
+    std::string manifest;
+
+    // The manager parses the config, and sends it to the workers with the octree params
+    template<typename SD>
+    void serde_visit(SD &sd) {
+        sd & bodies & seed & layout & extent & clusters & cluster_radius & sizes & size_min & size_max &
+            max_velocity.x & max_velocity.y & max_velocity.z & density & manifest;
+    }
+};
+
+constexpr float SIZE_QUANTUM = 0.25f;
+// The world is a box bounded by planes this far from the origin
+constexpr float WORLD_HALF_EXTENT = 150.0f;
+
+struct scenario_body {
+    uint64_t id;
+    physx::PxVec3 position;
+    float size;
+    physx::PxVec3 velocity;
+};
+
+// Parses the --scenario-* options, removing them from argc and argv so that what is left
+// can go to argument_parse. Returns false, having printed why, if an option is invalid.
+bool scenario_parse(int &argc, char *argv[], scenario_config &config);
+void scenario_usage(FILE *out);
+
+// Generates the bodies of a scenario in id order, in parallel. Each body is generated
+// from the seed and its id alone.
+std::vector<scenario_body> generate_scenario(const scenario_config &config);
+
+// A hash of the generated bodies, to check that two runs started from the same world
+uint64_t scenario_checksum(const std::vector<scenario_body> &bodies);
+
+// The bodies spawned into one cell of the initial cell size, as a single batch
+struct scenario_batch {
+    int32_t cell[3];
+    uint64_t bodies;
+};
+
+// Records what a run was started with. Returns false if the manifest cannot be written.
+bool write_scenario_manifest(const std::string &path, const scenario_config &config, float cell_size,
+    const std::vector<scenario_batch> &batches, uint64_t checksum);
@@ -1,10 +1,20 @@
 #include "simulate.hh"
 #include "protocol.hh"
+#include "contact_events.hh"
+#include "cpu_dispatcher.hh"
+#include "cell_broadphase.hh"
+#include "scenario.hh"
 
 #include <aether/cell_state.hh>
 #include <aether/common/net.hh>
 #include <aether/common/base_protocol.hh>
-#include <aether/common/random.hh>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdlib>
+#include <fmt/format.h>
+#include <memory>
+#include <thread>
 #include <unordered_map>
 #include<typeinfo>
 #include<cstring>
@@ -26,176 +36,436 @@ static physx::PxFilterFlags BasicFilterShader( physx::PxFilterObjectAttributes,
                                                PxU32) {
     // generate contacts for all
     pairFlags = physx::PxPairFlag::eCONTACT_DEFAULT;
-    // trigger the contact callback for any collision
-    pairFlags |= physx::PxPairFlag::eNOTIFY_TOUCH_FOUND;
+    // trigger the contact callback for any collision, with the contact points so that
+    // contact_event_buffer can record where and how hard
+    pairFlags |= physx::PxPairFlag::eNOTIFY_TOUCH_FOUND | physx::PxPairFlag::eNOTIFY_CONTACT_POINTS;
 
     return physx::PxFilterFlag::eDEFAULT;
 }
 
+// Logs the task pool metrics every this many ticks of each worker. Zero disables logging.
+static constexpr uint64_t DISPATCHER_LOG_INTERVAL = 0;
+
+// Logs the broadphase statistics every this many ticks of each worker. Zero disables logging.
+static constexpr uint64_t BROADPHASE_LOG_INTERVAL = 0;
+
+static physx::PxBounds3 get_cell_bounds(const aether_cell_state<octree_traits> &aether_state) {
+    const auto cell = aether_state.get_cell();
+    const vec3f origin = morton_3_decode(cell.code);
+    const float side = static_cast<float>(1ull << cell.level);
+    return physx::PxBounds3(PxVec3(origin.x, origin.y, origin.z), PxVec3(origin.x + side, origin.y + side, origin.z + side));
+}
+
+// With split-phase stepping, physx_update_system finishes the step started on the previous
+// tick, records its results and starts the next step without waiting for it. Sending
+// tick N to clients then overlaps with the PhysX step for tick N+1, so a tick takes about
+// the longer of the two rather than their sum, at the cost of clients seeing each step
+// one tick later. Otherwise each tick simulates a whole step and waits for it.
+static constexpr bool SPLIT_PHASE_STEP = true;
+
+struct body_state {
+    PxTransform pose;
+    PxVec3 velocity;
+};
+
+// A cell's step, and the entities PhysX moved in the last step to finish, from the scene's
+// active actors. cell_state_serialize sends these every tick and the others only as a
+// keepalive. With split-phase stepping their state when the step finished is recorded
+// too, by entity id, to send while the next step runs. PhysX itself returns the state
+// from before simulate() to reads during a step, so other actors can be read directly.
+struct physx_step {
+    bool in_flight = false;
+    // The length of the last step started
+    float delta_time = 0.0f;
+    // Sorted entity ids
+    std::vector<uint64_t> active;
+    std::unordered_map<uint64_t, body_state> bodies;
+};
+
+// Everything a cell keeps between ticks, owned by its state.user_data. initialise_cell
+// creates it and ticks only read it, so cells ticking at once share nothing. Members are
+// destroyed in reverse order: the bodies' pool and shapes before the PxPhysics that
+// created them, and the scene before the dispatcher, broadphase and contact buffer it uses.
+struct cell_context {
+    // Contacts are recorded into this during the PhysX tick and handled afterwards
+    contact_event_buffer contacts;
+    // Runs the scene's tasks on the task pool
+    std::unique_ptr<cell_cpu_dispatcher> dispatcher;
+    // Regions over the cell
+    std::unique_ptr<cell_broadphase> broadphase;
+    std::unique_ptr<aether::physx::physx_state> physx;
+    // The shapes and actors of the cell's bodies
+    std::unique_ptr<shape_registry> shapes;
+    std::unique_ptr<body_pool> pool;
+    physx_step step;
+    simulation_settings settings;
+    // Ticks simulated, sent to clients in the packet header so that they can time entity
+    // updates without the jitter of the network
+    uint64_t ticks = 0;
+};
+
+static body_state get_body_state(const physx::PxRigidActor &actor) {
+    body_state body{actor.getGlobalPose(), PxVec3(0.0f)};
+    if (const auto *dynamic = actor.is<physx::PxRigidDynamic>()) {
+        body.velocity = dynamic->getLinearVelocity();
+    }
+    return body;
+}
+
+// Waits for the running step and records which entities it moved
+static void fetch_physx_step(cell_context &context) {
+    physx::PxScene &scene = *context.physx->scene;
+    physx_step &step = context.step;
+    scene.fetchResults(true);
+    step.in_flight = false;
+    step.active.clear();
+    step.bodies.clear();
+
+    PxU32 num_active = 0;
+    physx::PxActor **active = scene.getActiveActors(num_active);
+    for (PxU32 i = 0; i < num_active; ++i) {
+        const uint64_t entity_id = get_actor_entity(*active[i]);
+        if (entity_id == NO_ENTITY) { continue; }
+        step.active.push_back(entity_id);
+        if (SPLIT_PHASE_STEP) {
+            if (const auto *rigid = active[i]->is<physx::PxRigidActor>()) {
+                step.bodies[entity_id] = get_body_state(*rigid);
+            }
+        }
+    }
+    std::sort(step.active.begin(), step.active.end());
+
+    // Actors returned during the step go back to the pool only now that the step's
+    // active actors have been read
+    context.pool->end_step();
+}
+
+static void start_physx_step(cell_context &context, const float delta_time) {
+    context.pool->begin_step();
+    context.physx->scene->simulate(delta_time);
+    context.step.in_flight = true;
+    context.step.delta_time = delta_time;
+}
+
+// The state to send for an entity, as recorded when the last step finished if another is running
+static body_state get_sent_body_state(const physx_step &step, const c_physx &physx, const uint64_t id) {
+    if (step.in_flight) {
+        const auto found = step.bodies.find(id);
+        if (found != step.bodies.end()) { return found->second; }
+    }
+    return get_body_state(*physx.actor);
+}
+
+// Agent AABBs are grown by this much on each side, for the contact offset of shapes and
+// for rotation during a step
+static constexpr float AGENT_AABB_MARGIN = 0.1f;
+// Agent AABBs are rounded outwards to multiples of this, so that they only change when a
+// body has moved some way rather than every tick
+static constexpr float AGENT_AABB_QUANTUM = 0.5f;
+
+physx::PxBounds3 get_agent_bounds(const user_cell_state &state, const c_physx &physx) {
+    const cell_context *context = static_cast<const cell_context*>(state.user_data);
+    const PxTransform pose = physx.actor->getGlobalPose();
+    // The world bounds of the body's box, from its shape rather than getWorldBounds(), which
+    // PhysX does not allow while the scene is stepping
+    const shape_desc &shape = physx.pool->get_shapes().get_desc(physx.shape_id);
+    physx::PxBounds3 bounds = physx::PxBounds3::poseExtent(pose, shape.half_extents);
+
+    // Sweep the bounds over the distance the body may move before they are next computed.
+    // With split-phase stepping the pose is from before the running step, so that adds a step.
+    const float sweep_time = context->step.delta_time * (SPLIT_PHASE_STEP ? 2.0f : 1.0f);
+    const PxVec3 sweep = physx.actor->getLinearVelocity() * sweep_time;
+    bounds.include(physx::PxBounds3(bounds.minimum + sweep, bounds.maximum + sweep));
+    bounds.fattenFast(AGENT_AABB_MARGIN);
+
+    for (int axis = 0; axis < 3; ++axis) {
+        bounds.minimum[axis] = std::floor(bounds.minimum[axis] / AGENT_AABB_QUANTUM) * AGENT_AABB_QUANTUM;
+        bounds.maximum[axis] = std::ceil(bounds.maximum[axis] / AGENT_AABB_QUANTUM) * AGENT_AABB_QUANTUM;
+    }
+    return bounds;
+}
+
+// How far beyond the cell the broadphase regions reach. Ghosts are the entities whose
+// agent AABB overlaps the cell, so this is the largest reach of an agent AABB past its
+// body's centre, as get_agent_bounds() computes it: the half diagonal of the scenario's
+// largest body, its sweep at the largest initial speed, and the margin and rounding.
+// Bodies that gravity or collisions speed up further may leave the regions, which the
+// broadphase logs.
+static float get_ghost_margin(const simulation_settings &settings) {
+    const scenario_config &scenario = settings.scenario;
+    const float sweep_time = (SPLIT_PHASE_STEP ? 2.0f : 1.0f) / settings.ticks_per_second;
+    return scenario.size_max * std::sqrt(3.0f) + scenario.max_velocity.magnitude() * sweep_time
+        + AGENT_AABB_MARGIN + AGENT_AABB_QUANTUM;
+}
+
+void finish_physx_step(user_cell_state &state) {
+    cell_context *context = static_cast<cell_context*>(state.user_data);
+    if (!context->step.in_flight) { return; }
+    fetch_physx_step(*context);
+}
+
+void restore_body(user_cell_state &state, c_physx &physx, shape_stream_reader &shape_stream) {
+    body_pool &pool = *static_cast<cell_context*>(state.user_data)->pool;
+    if (!create_handed_over_body(physx, pool, shape_stream)) {
+        AETHER_LOG(ERROR)(fmt::format("Handed over body uses shape {}, which was not defined", physx.record.shape_id));
+        abort();
+    }
+}
+
 // This is an ECS system, it calls the PhysX simulate tick on the worker once per tick.
 struct physx_update_system {
     using accessed_components = std::tuple<c_physx, c_trivial>;
     using ecs_type = aether::constrained_ecs<user_cell_state, accessed_components>;
     void operator()(const aether_cell_state<octree_traits> &aether_state, ecs_type &state, float delta_time) {
-        aether::physx::physx_state *physx_state = static_cast<aether::physx::physx_state*>(state.user_data);
-        physx_state->scene->simulate(delta_time);
-        physx_state->scene->fetchResults(true);
+        cell_context &context = *static_cast<cell_context*>(state.user_data);
+        // A dying cell is handing its entities over, so its step can wait for the others
+        context.dispatcher->set_priority(aether_state.is_cell_dying() ? task_priority::low : task_priority::normal);
+        if (SPLIT_PHASE_STEP && context.step.in_flight) {
+            fetch_physx_step(context);
+        }
+        // The cell may have been resized since the last step
+        const physx::PxBounds3 bounds = get_cell_bounds(aether_state);
+        if (context.broadphase->update(*context.physx->scene, bounds)) {
+            AETHER_LOG(DEBUG)(fmt::format("Broadphase regions rebuilt for cell ({}, {}, {}) to ({}, {}, {})",
+                bounds.minimum.x, bounds.minimum.y, bounds.minimum.z, bounds.maximum.x, bounds.maximum.y, bounds.maximum.z));
+        }
+        start_physx_step(context, delta_time);
+        if (!SPLIT_PHASE_STEP) {
+            fetch_physx_step(context);
+        }
     }
 };
 
-std::unordered_map<physx::PxActor*, user_cell_state::agent_reference> gPxActorToEntity;
-
-class ContactReportCallback: public ::physx::PxSimulationEventCallback
-{
-	void onConstraintBreak(physx::PxConstraintInfo* constraints, physx::PxU32 count)	{ PX_UNUSED(constraints); PX_UNUSED(count); }
-	void onWake(physx::PxActor** actors, physx::PxU32 count)							{ PX_UNUSED(actors); PX_UNUSED(count); }
-	void onSleep(physx::PxActor** actors, physx::PxU32 count)							{ PX_UNUSED(actors); PX_UNUSED(count); }
-	void onTrigger(physx::PxTriggerPair* pairs, physx::PxU32 count)					{ PX_UNUSED(pairs); PX_UNUSED(count); }
-	void onAdvance(const physx::PxRigidBody*const*, const physx::PxTransform*, const physx::PxU32) {}
-	void onContact(const physx::PxContactPairHeader& pairHeader, const physx::PxContactPair* pairs, physx::PxU32 nbPairs) 
-	{
-		for(physx::PxU32 i=0; i < nbPairs; i++)
-        {
-            const physx::PxContactPair& cp = pairs[i];
-
-            if(cp.events & physx::PxPairFlag::eNOTIFY_TOUCH_FOUND)
-            {
-                physx::PxActor* actor0 = pairHeader.actors[0];
-                physx::PxActor* actor1 = pairHeader.actors[1];
-                printf("actor0: %d, actor1: %d\n", actor0, actor1);
-
-                auto it0 = gPxActorToEntity.find(actor0);
-                printf("it0 found: %d\n", it0 != gPxActorToEntity.end());
-                if ( it0 != gPxActorToEntity.end() )
-                {
-                    auto agent0 = it0->second;
-                    auto triComp = agent0.get_dynamic<c_trivial>();
-                    triComp->agent_colour = {0.0f, 0.0f, 1.0f};
-                    //agent0.set
-                    printf("Set agent0: %d color\n", triComp->id);
-                }
-
-                auto it1 = gPxActorToEntity.find(actor1);
-                printf("it1 found: %d\n", it1 != gPxActorToEntity.end());
-                if ( it1 != gPxActorToEntity.end() )
-                {
-                    auto agent1 = it1->second;
-                    auto triComp = agent1.get_dynamic<c_trivial>();
-                    triComp->agent_colour =  {0.0f, 0.0f, 1.0f};
-                    printf("Set agent1: %d color\n", triComp->id);
-                }
+// Logs one contact in this many, for debugging. Zero disables logging.
+static constexpr uint64_t CONTACT_LOG_INTERVAL = 0;
+
+// The colour clients are sent for bodies that have touched another
+static const colour CONTACT_COLOUR(0.0f, 0.0f, 1.0f);
+
+// This ECS system runs after physx_update_system and acts on the contacts recorded during
+// the PhysX tick. The bodies that collided have already been marked touched, which turns
+// them blue.
+struct contact_event_system {
+    using accessed_components = std::tuple<c_physx>;
+    using ecs_type = aether::constrained_ecs<user_cell_state, accessed_components>;
+    void operator()(const aether_cell_state<octree_traits> &aether_state, ecs_type &state, float delta_time) {
+        contact_event_buffer &contacts = static_cast<cell_context*>(state.user_data)->contacts;
+
+        const auto &events = contacts.get_events();
+        for (size_t i = 0; i < events.size(); ++i) {
+            const contact_event &event = events[i];
+            // The events recorded this tick are the first of the contacts counted this tick
+            const uint64_t sequence = contacts.get_total() - contacts.get_dropped() - events.size() + i;
+            if (CONTACT_LOG_INTERVAL != 0 && sequence % CONTACT_LOG_INTERVAL == 0) {
+                AETHER_LOG(DEBUG)(fmt::format("Contact {} between entities {} and {}: impulse={} at ({}, {}, {})",
+                    sequence, event.entity0, event.entity1,
+                    event.impulse, event.point.x, event.point.y, event.point.z));
             }
         }
-	}
-};
 
-ContactReportCallback gContactReportCallback;
+        if (contacts.get_dropped() != 0) {
+            AETHER_LOG(WARN)(fmt::format("Dropped {} contacts, more than the buffer holds", contacts.get_dropped()));
+        }
+        contacts.clear();
+    }
+};
 
 // This is the cell tick function as described in main.cc. It calls the ECS internal tick function
 void cell_tick(const aether_cell_state<octree_traits> &aether_state, user_cell_state &state, float delta_time) {
     state.tick(aether_state, delta_time);
+    cell_context &context = *static_cast<cell_context*>(state.user_data);
+    const uint64_t tick = ++context.ticks;
+
+    if (DISPATCHER_LOG_INTERVAL != 0 && tick % DISPATCHER_LOG_INTERVAL == 0) {
+        const task_pool &pool = context.dispatcher->get_pool();
+        AETHER_LOG(DEBUG)(fmt::format("PhysX tasks: {} submitted by this cell, {} queued, {} run, {} stolen on {} threads",
+            context.dispatcher->get_submitted(), pool.get_queue_depth(), pool.get_executed(),
+            pool.get_steals(), pool.get_worker_count()));
+    }
+
+    if (BROADPHASE_LOG_INTERVAL != 0 && tick % BROADPHASE_LOG_INTERVAL == 0) {
+        const broadphase_stats stats = get_broadphase_stats(aether_state, state);
+        AETHER_LOG(DEBUG)(fmt::format("Broadphase: {} regions, {} static and {} dynamic objects in them, {} out of bounds, "
+            "{} rebuilds, {} adds, {} removes and {} pairs last step", stats.regions, stats.static_objects,
+            stats.dynamic_objects, stats.out_of_bounds, stats.rebuilds, stats.adds, stats.removes, stats.pairs));
+    }
+}
+
+broadphase_stats get_broadphase_stats(const aether_cell_state<octree_traits> &aether_state, user_cell_state &state) {
+    // Statistics cannot be read while the scene is stepping
+    finish_physx_step(state);
+    const cell_context &context = *static_cast<const cell_context*>(state.user_data);
+    return context.broadphase->get_stats(*context.physx->scene);
+}
+
+// physx_state creates its scene with a dispatcher of its own, and PhysX cannot change the
+// dispatcher or broadphase of an existing scene. The scene is therefore replaced, before
+// anything is added to it, by one with the same settings running on the shared task pool,
+// with the cell's broadphase.
+static void recreate_scene(aether::physx::physx_state &physx_state, physx::PxCpuDispatcher &dispatcher, cell_broadphase &broadphase) {
+    physx::PxScene *old_scene = physx_state.scene;
+    physx::PxSceneDesc desc(physx_state.physics->getTolerancesScale());
+    desc.gravity = old_scene->getGravity();
+    desc.flags = old_scene->getFlags();
+    desc.filterShader = old_scene->getFilterShader();
+    desc.filterShaderData = old_scene->getFilterShaderData();
+    desc.filterShaderDataSize = old_scene->getFilterShaderDataSize();
+    desc.simulationEventCallback = old_scene->getSimulationEventCallback();
+    desc.broadPhaseType = old_scene->getBroadPhaseType();
+    desc.frictionType = old_scene->getFrictionType();
+    desc.solverType = old_scene->getSolverType();
+    desc.bounceThresholdVelocity = old_scene->getBounceThresholdVelocity();
+    desc.cpuDispatcher = &dispatcher;
+    broadphase.configure(desc);
+
+    physx::PxScene *scene = desc.isValid() ? physx_state.physics->createScene(desc) : nullptr;
+    if (scene == nullptr) {
+        AETHER_LOG(ERROR)("Failed to create a PhysX scene on the shared task pool");
+        abort();
+    }
+    old_scene->release();
+    physx_state.scene = scene;
 }
 
 // This is called once when a new worker is spawned into the simualation and assigned an area of simulation space to 
 // cover, In this simulation we have the world bounds on the cubes stored in each worker rather than as entities and 
 // we use this function to ensure each worker has a copy.
-void initialise_cell(const aether_cell_state<octree_traits> &aether_state, user_cell_state &state) {
-    state.user_data = new aether::physx::physx_state(static_cast<::physx::PxSimulationEventCallback*>(state.user_data));
+void initialise_cell(const aether_cell_state<octree_traits> &aether_state, user_cell_state &state, const simulation_settings &settings) {
+    cell_context *context = new cell_context();
+    context->settings = settings;
+    state.user_data = context;
+    context->physx = std::make_unique<aether::physx::physx_state>(&context->contacts);
     state.add_system<physx_update_system>();
-    aether::physx::physx_state *physx_state = static_cast<aether::physx::physx_state*>(state.user_data);;
+    state.add_system<contact_event_system>();
+    aether::physx::physx_state *physx_state = context->physx.get();
+    physx_state->scene->setSimulationEventCallback(&context->contacts);
+
+    // The cell's PhysX tasks run on the pool shared by every cell in the process. Threads
+    // calling simulate() block in fetchResults() while their step runs, so the pool can
+    // have a thread for each of the worker's share of the host's cores.
+    const uint32_t task_threads = std::thread::hardware_concurrency() / std::max(1u, settings.workers_per_host);
+    context->dispatcher = std::make_unique<cell_cpu_dispatcher>(task_pool::get(task_threads));
+    context->broadphase = std::make_unique<cell_broadphase>(get_ghost_margin(settings));
+    recreate_scene(*physx_state, *context->dispatcher, *context->broadphase);
+    context->broadphase->update(*physx_state->scene, get_cell_bounds(aether_state));
+    // Serialisation sends the actors that moved, listed by PhysX after each step
+    physx_state->scene->setFlag(physx::PxSceneFlag::eENABLE_ACTIVE_ACTORS, true);
+    context->shapes = std::make_unique<shape_registry>(*physx_state->physics);
+    context->pool = std::make_unique<body_pool>(*physx_state->physics, *physx_state->scene, *context->shapes);
 
     // Creating the world bounds. The world is bounded by 6 planes Making a box
     // You must ensure that you release the material after it is used to create a shape
     physx::PxMaterial* zPositiveMaterial = physx_state->physics->createMaterial(0.0f,0.0f,1.0f);
-    auto zPositivePlane = physx::PxCreatePlane(*physx_state->physics, PxPlane(0,0,1,150), *zPositiveMaterial);
+    auto zPositivePlane = physx::PxCreatePlane(*physx_state->physics, PxPlane(0,0,1,WORLD_HALF_EXTENT), *zPositiveMaterial);
     zPositiveMaterial->release();
     physx_state->scene->addActor(*zPositivePlane);
 
     physx::PxMaterial* zNegativeMaterial = physx_state->physics->createMaterial(0.0f,0.0f,1.0f);
-    auto zNegativePlane = physx::PxCreatePlane(*physx_state->physics, PxPlane(0,0,-1,150), *zNegativeMaterial);
+    auto zNegativePlane = physx::PxCreatePlane(*physx_state->physics, PxPlane(0,0,-1,WORLD_HALF_EXTENT), *zNegativeMaterial);
     zNegativeMaterial->release();
     physx_state->scene->addActor(*zNegativePlane);
 
     physx::PxMaterial* yPositiveMaterial = physx_state->physics->createMaterial(0.0f,0.0f,1.0f);
-    auto yPositivePlane = physx::PxCreatePlane(*physx_state->physics, PxPlane(0,1,0,150), *yPositiveMaterial);
+    auto yPositivePlane = physx::PxCreatePlane(*physx_state->physics, PxPlane(0,1,0,WORLD_HALF_EXTENT), *yPositiveMaterial);
     yPositiveMaterial->release();
     physx_state->scene->addActor(*yPositivePlane);
 
     physx::PxMaterial* yNegativeMaterial = physx_state->physics->createMaterial(0.0f,0.0f,1.0f);
-    auto yNegativePlane = physx::PxCreatePlane(*physx_state->physics, PxPlane(0,-1,0,150), *yNegativeMaterial);
+    auto yNegativePlane = physx::PxCreatePlane(*physx_state->physics, PxPlane(0,-1,0,WORLD_HALF_EXTENT), *yNegativeMaterial);
     yNegativeMaterial->release();
     physx_state->scene->addActor(*yNegativePlane);
 
     physx::PxMaterial* xPositiveMaterial = physx_state->physics->createMaterial(0.0f,0.0f,1.0f);
-    auto xPositivePlane = physx::PxCreatePlane(*physx_state->physics, PxPlane(1,0,0,150), *xPositiveMaterial);
+    auto xPositivePlane = physx::PxCreatePlane(*physx_state->physics, PxPlane(1,0,0,WORLD_HALF_EXTENT), *xPositiveMaterial);
     xPositiveMaterial->release();
     physx_state->scene->addActor(*xPositivePlane);
 
     physx::PxMaterial* xNegativeMaterial = physx_state->physics->createMaterial(0.0f,0.0f,1.0f);
-    auto xNegativePlane = physx::PxCreatePlane(*physx_state->physics, PxPlane(-1,0,0,150), *xNegativeMaterial);
+    auto xNegativePlane = physx::PxCreatePlane(*physx_state->physics, PxPlane(-1,0,0,WORLD_HALF_EXTENT), *xNegativeMaterial);
     xNegativeMaterial->release();
     physx_state->scene->addActor(*xNegativePlane);
 }
 
 void deinitialise_cell(const aether_cell_state<octree_traits> &aether_state, user_cell_state &state) {
+    // The scene cannot be released during a step
+    finish_physx_step(state);
+    // The bodies are released before the pool they came from
     state.clear();
-    delete static_cast<aether::physx::physx_state*>(state.user_data);
+    delete static_cast<cell_context*>(state.user_data);
+    state.user_data = nullptr;
 }
 
 // This function is called once at the start of the simulation, it is called on the initial worker. Any entities it 
 // creates are then sent to workers that cover their area of space. 
-// For this demo we create 500 PhysX cubes with random rotation, position and velocity
+// For this demo we create the PhysX cubes of the scenario given on the command line (see scenario.hh)
 void initialise_world(const aether_cell_state<octree_traits> &aether_state, user_cell_state &state) {
     const auto cell = aether_state.get_cell();
-    aether::physx::physx_state *physx_state = static_cast<aether::physx::physx_state*>(state.user_data);;
-
-    physx_state->scene->setSimulationEventCallback(&gContactReportCallback);
-
-    // static friction, dynamic friction, restitution; COR = 1 means perfectly elastic collision
-    // NOTE: currently serializer requires every entity to have a separate material and shape, so identical materials
-    // and shapes must be defined for each entity
-    for(int i = 0; i < 10; i++){
-      //float size_rnd = generate_random_f32();
-      float size = 1.0f;//(size_rnd*3) + 1;
-      PxReal extent(size);
-      physx::PxMaterial* material = physx_state->physics->createMaterial(0.0f, 0.0f, 1.0f);
-      physx::PxShape* actor_shape = physx_state->physics->createShape(physx::PxBoxGeometry(extent, extent, extent), *material);
-
-      physx::PxTransform actor_position = physx::PxTransform(physx::PxVec3((generate_random_f32()-0.5f)*200, 
-        (generate_random_f32()-0.5f)*200, 
-        (generate_random_f32()-0.5f)*200)
-      );
-      physx::PxRigidDynamic* actor =  physx_state->physics->createRigidDynamic(actor_position);
-      actor->attachShape(*actor_shape);
-      physx::PxRigidBodyExt::updateMassAndInertia(*actor, 10.0f);
-      actor->setLinearVelocity(4.0f*PxVec3((generate_random_f32()-0.5f)*10,(generate_random_f32()-0.5f)*40,(generate_random_f32()-0.5f)*10));
-
-      auto update = state.create_update_set();
-
-      auto agent = update.new_entity_local();
-      auto physx = agent.create_component<c_physx>();
-      physx->add_actor(*actor);
-      physx->add_to_simulation();
-      auto trivial = agent.create_component<c_trivial>();
-      trivial->id = i;
-      trivial->size = size;
-      //trivial->agent_colour.r *= size_rnd;
-
-      //const std::type_info& typeOfAgent = typeid(agent);
-      //printf("agent type: %s\n", typeOfAgent.name());
-
-      gPxActorToEntity.insert({ dynamic_cast<physx::PxActor*>(actor), agent});
-
-      // Unlike most physX applications, we need to maintain a shape and material for each entity,
-      // rather than using the same material across many entities.
-      material->release();
-      actor_shape->release();
+    // The initial worker's cell has been initialised with the settings main was run with
+    const scenario_config &scenario = static_cast<const cell_context*>(state.user_data)->settings.scenario;
+    const std::vector<scenario_body> bodies = generate_scenario(scenario);
+    const uint64_t checksum = scenario_checksum(bodies);
+
+    // The bodies are spawned in a batch for each cell of the initial size, so that each
+    // worker receives its bodies together
+    const float cell_size = static_cast<float>(1ull << cell.level);
+    const auto cell_of = [cell_size](const scenario_body &body) {
+        return std::array<int32_t, 3>{
+            static_cast<int32_t>(std::floor(body.position.x / cell_size)),
+            static_cast<int32_t>(std::floor(body.position.y / cell_size)),
+            static_cast<int32_t>(std::floor(body.position.z / cell_size)),
+        };
+    };
+    std::vector<std::pair<std::array<int32_t, 3>, size_t>> order;
+    order.reserve(bodies.size());
+    for (size_t i = 0; i < bodies.size(); ++i) {
+        order.emplace_back(cell_of(bodies[i]), i);
+    }
+    std::sort(order.begin(), order.end());
+
+    // Cubes of the same size share one shape and material
+    body_pool &pool = *static_cast<cell_context*>(state.user_data)->pool;
+    shape_registry &shapes = pool.get_shapes();
+    std::vector<scenario_batch> batches;
+    for (size_t begin = 0; begin < order.size();) {
+        size_t end = begin;
+        while (end < order.size() && order[end].first == order[begin].first) { ++end; }
+
+        auto update = state.create_update_set();
+        for (size_t i = begin; i < end; ++i) {
+            const scenario_body &body = bodies[order[i].second];
+            // static friction, dynamic friction, restitution; COR = 1 means perfectly elastic collision
+            const uint32_t shape_id = shapes.intern(shape_desc::box(body.size, 0.0f, 0.0f, 1.0f));
+            physx::PxRigidDynamic* actor = pool.acquire(shape_id, physx::PxTransform(body.position));
+            physx::PxRigidBodyExt::updateMassAndInertia(*actor, scenario.density);
+            actor->setLinearVelocity(body.velocity);
+
+            auto agent = update.new_entity_local();
+            auto physx = agent.create_component<c_physx>();
+            physx->actor = actor;
+            physx->shape_id = shape_id;
+            physx->pool = &pool;
+            auto trivial = agent.create_component<c_trivial>();
+            trivial->id = body.id;
+            trivial->size = body.size;
+
+            physx->set_entity(trivial->id);
+        }
+
+        const auto &batch_cell = order[begin].first;
+        batches.push_back(scenario_batch{{batch_cell[0], batch_cell[1], batch_cell[2]}, end - begin});
+        begin = end;
+    }
+
+    AETHER_LOG(INFO)(fmt::format("Spawned {} bodies in {} batches from seed {}, with {} shapes, checksum {:016x}",
+        bodies.size(), batches.size(), scenario.seed, shapes.size(), checksum));
+    if (!scenario.manifest.empty() && !write_scenario_manifest(scenario.manifest, scenario, cell_size, batches, checksum)) {
+        AETHER_LOG(ERROR)(fmt::format("Failed to write the scenario manifest to {}", scenario.manifest));
     }
 }
 
 // This code handles how data leaves the simulation to the client, as described in main.cc. 
 // Packets consist of a header describing the aether cell, and then a list of entities in the 
-// format protocol::base::net_point_3d
+// format protocol::base::net_moving_point_3d
 void cell_state_serialize(const aether_cell_state<octree_traits>& aether_state, const user_cell_state &state, client_writer_type &writer) {
     protocol::base::client_message header;
     const auto cell = aether_state.get_cell();
@@ -209,13 +479,23 @@ void cell_state_serialize(const aether_cell_state<octree_traits>& aether_state,
     header.stats.num_agents = state.num_agents_local();
     header.stats.num_agents_ghost = state.num_agents_ghost();
     header.cell_dying = aether_state.is_cell_dying();
+    const cell_context &context = *static_cast<const cell_context*>(state.user_data);
+    header.tick = context.ticks;
     marshaller.add_worker_data(aether_state.get_worker().as_u64(), header);
 
     for (auto agent: state.local_entities<c_physx, c_trivial>()) {
         auto physx = agent.get<c_physx>();
         auto trivial = agent.get<c_trivial>();
 
-        PxTransform t = physx->actor->getGlobalPose();
+        // Entities at rest are sent round-robin, a share of them each tick, so that the
+        // muxer keeps them
+        if ((trivial->id + header.tick) % ENTITY_KEEPALIVE_TICKS != 0 &&
+            !std::binary_search(context.step.active.begin(), context.step.active.end(), trivial->id)) {
+            continue;
+        }
+
+        const body_state body = get_sent_body_state(context.step, *physx, trivial->id);
+        PxTransform t = body.pose;
         vec3f position = transform_to_vec3f(t);
         protocol::base::net_quat q;
         q.x = t.q.x;
@@ -223,9 +503,13 @@ void cell_state_serialize(const aether_cell_state<octree_traits>& aether_state,
         q.z = t.q.z;
         q.w = t.q.w;
 
-        protocol::base::net_point_3d point;
+        // Clients extrapolate with the velocity between updates
+        const vec3f velocity = vec3f_new(body.velocity.x, body.velocity.y, body.velocity.z);
+
+        protocol::base::net_moving_point_3d point;
         point.net_encoded_position = position;
-        point.net_encoded_color = net_encode_color(trivial->agent_colour);
+        point.net_encoded_velocity = velocity;
+        point.net_encoded_color = net_encode_color(physx->touched ? CONTACT_COLOUR : trivial->agent_colour);
         point.net_encoded_orientation = q;
         point.id = trivial->id;
         point.size = trivial->size;
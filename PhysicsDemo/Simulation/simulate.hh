@@ -8,7 +8,6 @@
 #include <aether/octree_params.hh>
 #include <aether/demo/physx/physx.hh>
 #include <aether/demo/ecs/ecs.hh>
-using c_physx = aether::physx::physx_c;
 #include <aether/common/serde_derive.hh>
 
 #include <PxPhysics.h>
@@ -23,6 +22,11 @@ using c_physx = aether::physx::physx_c;
 
 #include <signal.h>
 
+#include "cell_broadphase.hh"
+#include "contact_events.hh"
+#include "physx_body.hh"
+#include "scenario.hh"
+
 // A common simple component used by all entities in this demo. We give it a colour to see 
 struct c_trivial {
     struct colour agent_colour = {1.0f, 0.0f, 0.0f};
@@ -43,14 +47,38 @@ using user_cell_state = aether::ecs<octree_traits, component_types>;
 
 using octree_params_type = octree_params_default<octree_traits>;
 
+// What every cell runs with, from the manager's command line. Workers never run main, so
+// main captures this in build_user_state, which the octree params take to each of them.
+struct simulation_settings {
+    scenario_config scenario;
+    // The ticks per second of the simulation, which bounds how far bodies move in a step
+    float ticks_per_second = 15.0f;
+    // Workers run on each host, which share its cores between their PhysX task pools
+    uint32_t workers_per_host = 1;
+
+    template<typename SD>
+    void serde_visit(SD &sd) {
+        sd & scenario & ticks_per_second & workers_per_host;
+    }
+};
+
 // These are the functions used to initalise the world and setup Aether in main.cc, they are described in more detail in main.cc 
 void initialise(const aether_cell_state<octree_traits> &aether_state, user_cell_state &state);
 void initialise_world(const aether_cell_state<octree_traits> &aether_state, user_cell_state &state);
-void initialise_cell(const aether_cell_state<octree_traits> &aether_state, user_cell_state &state);
+void initialise_cell(const aether_cell_state<octree_traits> &aether_state, user_cell_state &state, const simulation_settings &settings);
 void handle_events(const aether_cell_state<octree_traits> &aether_state, user_cell_state &state, message_reader_type &reader);
 void cell_tick(const aether_cell_state<octree_traits> &aether_state, user_cell_state &state, float delta_time);
 void cell_state_serialize(const aether_cell_state<octree_traits>& aether_state, const user_cell_state &state, client_writer_type &writer);
 void deinitialise_cell(const aether_cell_state<octree_traits> &aether_state, user_cell_state &state);
+// Waits for the cell's PhysX step if one is running, as it may be between ticks with split-phase stepping
+void finish_physx_step(user_cell_state &state);
+// The region in which an entity may touch others before the next tick: its bounds swept
+// by its velocity, with a margin, quantised to limit how often it changes
+physx::PxBounds3 get_agent_bounds(const user_cell_state &state, const c_physx &physx);
+// The broadphase statistics of the cell's scene, waiting for its step if one is running
+broadphase_stats get_broadphase_stats(const aether_cell_state<octree_traits> &aether_state, user_cell_state &state);
+// Creates the actor of a body that has been handed over to the cell
+void restore_body(user_cell_state &state, c_physx &physx, shape_stream_reader &shape_stream);
 
 
 //The following is some default setup code, it is explained in more detail in the Aether Documentation
@@ -60,6 +88,7 @@ struct agent_serializer {
     user_cell_state &state;
     writer_type &writer;
     user_cell_state::serialization_context<writer_type> serialization_context;
+    shape_stream_writer shape_stream;
 
     agent_serializer(user_cell_state&, writer_type &_writer);
     int serialize(user_cell_state::agent_reference agent);
@@ -71,6 +100,7 @@ struct agent_deserializer {
     user_cell_state &state;
     reader_type &reader;
     user_cell_state::deserialization_context<reader_type> deserialization_context;
+    shape_stream_reader shape_stream;
 
     agent_deserializer(user_cell_state&, reader_type &_reader);
     user_cell_state::agent_reference deserialize();
@@ -82,7 +112,17 @@ agent_deserializer<Reader>::agent_deserializer(user_cell_state &_state, reader_t
 
 template<typename Reader>
 user_cell_state::agent_reference agent_deserializer<Reader>::deserialize() {
-    return deserialization_context.deserialize_entity();
+    // Entities change hands between steps
+    finish_physx_step(state);
+    auto agent = deserialization_context.deserialize_entity();
+    // Entities arriving from another cell have new actors, which need their entity id
+    if (auto physx = agent.get_dynamic<c_physx>()) {
+        restore_body(state, *physx, shape_stream);
+        if (auto trivial = agent.get_dynamic<c_trivial>()) {
+            physx->set_entity(trivial->id);
+        }
+    }
+    return agent;
 }
 
 template<typename Writer>
@@ -91,6 +131,10 @@ agent_serializer<Writer>::agent_serializer(user_cell_state &_state, writer_type
 
 template<typename Writer>
 int agent_serializer<Writer>::serialize(user_cell_state::agent_reference entity) {
+    finish_physx_step(state);
+    if (auto physx = entity.get_dynamic<c_physx>()) {
+        prepare_body_handover(*physx, shape_stream);
+    }
     return serialization_context.serialize_entity(entity);
 }
 